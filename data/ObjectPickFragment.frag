@@ -0,0 +1,10 @@
+#version 330 core
+
+uniform uint ObjectId; // PICK_OBJECT_BIT | index+1
+
+layout(location = 0) out uint Id;
+
+void main()
+{
+	Id = ObjectId;
+}
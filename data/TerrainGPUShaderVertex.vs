@@ -0,0 +1,49 @@
+#version 330 core
+
+// No vertex attributes: instance is a tile of Chunk, gl_VertexID picks
+// one of 6 corners of its two triangles
+uniform usampler2D Heights; // raw map point heights
+uniform usampler2D Tiles; // packed tiles, see TilePack
+uniform ivec3 Chunk; // first tile x, y and chunk width in tiles
+
+// Shared with all programs, see PerFrameData
+layout(std140) uniform PerFrame {
+	mat4 ViewProjection;
+	vec4 CameraPosition;
+	vec4 Viewport;
+	float Time;
+};
+uniform mat4 Model;
+
+out vec3 VaryingTextureCoordinates; // u, v, layer
+out vec2 VaryingMapPosition; // in map points
+
+const float TileSize = 128.0;
+const float HeightScale = 4.0; // TERRAIN_HEIGHT_SCALE
+
+// 0 1
+// 3 2
+const int Straight[6] = int[6](0, 1, 2, 0, 3, 2);
+const int Flipped[6] = int[6](3, 0, 1, 3, 2, 1);
+const ivec2 Corners[4] = ivec2[4](ivec2(0, 0), ivec2(1, 0), ivec2(1, 1), ivec2(0, 1));
+
+void main()
+{
+	ivec2 tile = Chunk.xy + ivec2(gl_InstanceID % Chunk.z, gl_InstanceID / Chunk.z);
+	uint bits = texelFetch(Tiles, tile, 0).r;
+	int corner = ((bits >> 13u) & 1u) != 0u ? Flipped[gl_VertexID] : Straight[gl_VertexID];
+	ivec2 point = tile + Corners[corner];
+	float height = float(texelFetch(Heights, point, 0).r);
+	// texture corner after rotation and flips, same as TileTextureCorners
+	int t = (corner - int((bits >> 9u) & 3u)) & 3;
+	if(((bits >> 11u) & 1u) != 0u) {
+		t ^= 1;
+	}
+	if(((bits >> 12u) & 1u) != 0u) {
+		t = 3 - t;
+	}
+	vec2 uv = vec2(float(t == 1 || t == 2), float(t >= 2));
+	gl_Position = ViewProjection * Model * vec4(point.x*TileSize, height*HeightScale, point.y*TileSize, 1.0);
+	VaryingTextureCoordinates = vec3(uv, float(bits & 0x1FFu));
+	VaryingMapPosition = vec2(point);
+}
@@ -0,0 +1,14 @@
+#version 330 core
+
+in vec2 VaryingMapPosition; // in map points
+
+uniform ivec2 MapSize; // in map points
+
+layout(location = 0) out uint Id;
+
+// PickBuffer id of the tile: y*w+x+1, 0 is left for nothing
+void main()
+{
+	ivec2 tile = clamp(ivec2(floor(VaryingMapPosition)), ivec2(0), MapSize - 2);
+	Id = uint(tile.y * MapSize.x + tile.x + 1);
+}
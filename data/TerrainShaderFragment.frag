@@ -1,15 +1,67 @@
 #version 330 core
 
-varying vec3 VaryingTextureCoordinates;
+varying vec3 VaryingTextureCoordinates; // u, v, layer
+varying vec2 VaryingMapPosition; // in map points
 
-uniform sampler2D Texture;
+uniform sampler2DArray Texture;
+// Tile residency: layers with a slot are sampled from full quality
+// TileHot, TileSlots holds slot of every tile layer or -1
+uniform sampler2DArray TileHot;
+uniform isampler2D TileSlots;
+uniform int TileResidency;
+// Ground splatting: GroundWeights has 4 ground weights per layer for
+// every map point, Grounds has one layer per ground type
+uniform sampler2DArray Grounds;
+uniform sampler2DArray GroundWeights;
+uniform int GroundCount;
+uniform int GroundLayers[16];
+uniform float GroundScales[16]; // ground page repeats per world unit
+uniform vec4 GroundPlaceholders[16]; // average colour, a is 1 until page is loaded
+uniform vec2 MapSize;
+uniform float GroundMix;
 
 layout(location = 0) out vec4 Color;
 
+const float TileSize = 128.0;
+
+vec3 GroundColor()
+{
+	vec2 weightsuv = (VaryingMapPosition + 0.5) / MapSize;
+	vec2 world = VaryingMapPosition * TileSize;
+	vec3 color = vec3(0.0);
+	float total = 0.0;
+	vec4 weights = vec4(0.0);
+	for(int i = 0; i < GroundCount; i++) {
+		if(i % 4 == 0) {
+			weights = texture(GroundWeights, vec3(weightsuv, float(i / 4)));
+		}
+		float weight = weights[i % 4];
+		if(weight > 0.0) {
+			vec4 placeholder = GroundPlaceholders[i];
+			vec3 ground = placeholder.a > 0.5 ? placeholder.rgb : texture(Grounds, vec3(world * GroundScales[i], float(GroundLayers[i]))).rgb;
+			color += weight * ground;
+			total += weight;
+		}
+	}
+	return total > 0.0 ? color / total : color;
+}
+
+vec3 TileColor()
+{
+	if(TileResidency != 0) {
+		int slot = texelFetch(TileSlots, ivec2(int(VaryingTextureCoordinates.z + 0.5), 0), 0).r;
+		if(slot >= 0) {
+			return texture(TileHot, vec3(VaryingTextureCoordinates.xy, float(slot))).rgb;
+		}
+	}
+	return texture(Texture, VaryingTextureCoordinates).rgb;
+}
+
 void main()
 {
-	//Color = texture(Texture, VaryingTextureCoordinates);
-	Color.rgb = texture(Texture, VaryingTextureCoordinates.xy).rgb;
-	Color.a = VaryingTextureCoordinates.z;
-	//Color = vec4(1.0, 1.0, 1.0, 1.0);
+	Color.rgb = TileColor();
+	if(GroundMix > 0.0) {
+		Color.rgb = mix(Color.rgb, GroundColor(), GroundMix);
+	}
+	Color.a = 1.0;
 }
@@ -1,22 +1,34 @@
 #version 330 core
 
-attribute vec4 VertexCoordinates;
-attribute vec3 TextureCoordinates;
-attribute vec3 TextureGroundCoordinates;
+// Packed TerrainVertex: map point, raw height, tile texture layer,
+// normalized coordinates inside of it and TERRAIN_VERTEX_* flags.
+// Locations are fixed so picking program shares terrain vertex arrays
+layout(location = 0) in vec2 VertexTile;
+layout(location = 1) in float VertexHeight;
+layout(location = 2) in uint TextureLayer;
+layout(location = 3) in vec2 TextureCoordinates;
+layout(location = 4) in uint VertexFlags;
 
-uniform mat4 ViewProjection;
+// Shared with all programs, see PerFrameData
+layout(std140) uniform PerFrame {
+	mat4 ViewProjection;
+	vec4 CameraPosition;
+	vec4 Viewport;
+	float Time;
+};
 uniform mat4 Model;
 uniform int Pass;
 
-varying vec3 VaryingTextureCoordinates;
+out vec3 VaryingTextureCoordinates; // u, v, layer
+out vec2 VaryingMapPosition; // in map points
+
+const float TileSize = 128.0;
+const float HeightScale = 4.0; // TERRAIN_HEIGHT_SCALE
 
 void main()
 {
-    gl_Position = ViewProjection * Model * VertexCoordinates;
-	if(Pass == 0) {
-		VaryingTextureCoordinates = TextureCoordinates;
-	} else {
-		VaryingTextureCoordinates = TextureCoordinates;
-
-	}
+	vec4 position = vec4(VertexTile.x*TileSize, VertexHeight*HeightScale, VertexTile.y*TileSize, 1.0);
+	gl_Position = ViewProjection * Model * position;
+	VaryingTextureCoordinates = vec3(TextureCoordinates, float(TextureLayer));
+	VaryingMapPosition = VertexTile;
 }
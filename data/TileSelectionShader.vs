@@ -2,7 +2,13 @@
 
 attribute vec4 VertexCoordinates;
 
-uniform mat4 ViewProjection;
+// Shared with all programs, see PerFrameData
+layout(std140) uniform PerFrame {
+    mat4 ViewProjection;
+    vec4 CameraPosition;
+    vec4 Viewport;
+    float Time;
+};
 
 void main()
 {
@@ -1,12 +1,18 @@
 #version 330 core
 
-attribute vec4 VertexCoordinates;
-attribute vec2 TextureCoordinates;
+layout(location = 0) in vec4 VertexCoordinates;
+layout(location = 1) in vec2 TextureCoordinates;
 
-uniform mat4 ViewProjection;
+// Shared with all programs, see PerFrameData
+layout(std140) uniform PerFrame {
+    mat4 ViewProjection;
+    vec4 CameraPosition;
+    vec4 Viewport;
+    float Time;
+};
 uniform mat4 Model;
 
-varying vec2 VaryingTextureCoordinates;
+out vec2 VaryingTextureCoordinates;
 
 void main()
 {
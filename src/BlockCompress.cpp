@@ -0,0 +1,286 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "BlockCompress.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static inline void Unpack565(uint16_t c, int rgb[3]) {
+	rgb[0] = ((c >> 11) & 31) * 255 / 31;
+	rgb[1] = ((c >> 5) & 63) * 255 / 63;
+	rgb[2] = (c & 31) * 255 / 31;
+}
+
+static inline uint16_t Pack565(float r, float g, float b) {
+	auto q = [] (float v, int max) {
+		int i = (int)(v * max / 255.0f + 0.5f);
+		return i < 0 ? 0 : i > max ? max : i;
+	};
+	return q(r, 31) << 11 | q(g, 63) << 5 | q(b, 31);
+}
+
+// 4 color palette of color block, 3 color mode is never produced
+static void ColorPalette(uint16_t c0, uint16_t c1, bool allow3, int pal[4][3]) {
+	Unpack565(c0, pal[0]);
+	Unpack565(c1, pal[1]);
+	for(int i=0; i<3; i++) {
+		if(c0 > c1 || !allow3) {
+			pal[2][i] = (2*pal[0][i] + pal[1][i]) / 3;
+			pal[3][i] = (pal[0][i] + 2*pal[1][i]) / 3;
+		} else {
+			pal[2][i] = (pal[0][i] + pal[1][i]) / 2;
+			pal[3][i] = 0;
+		}
+	}
+}
+
+static uint32_t ColorIndexes(const uint8_t* rgba, int pal[4][3], int* error) {
+	uint32_t idx = 0;
+	*error = 0;
+	for(int p=0; p<16; p++) {
+		int best = 0, bestd = 1 << 30;
+		for(int i=0; i<4; i++) {
+			int dr = rgba[p*4+0]-pal[i][0], dg = rgba[p*4+1]-pal[i][1], db = rgba[p*4+2]-pal[i][2];
+			int d = dr*dr + dg*dg + db*db;
+			if(d < bestd) {
+				bestd = d;
+				best = i;
+			}
+		}
+		idx |= best << (p*2);
+		*error += bestd;
+	}
+	return idx;
+}
+
+// Endpoints along principal axis of block colors, then one least
+// squares refit of endpoints to chosen indexes
+static void CompressColor(const uint8_t* rgba, uint8_t* out) {
+	float mean[3] = {0, 0, 0};
+	for(int p=0; p<16; p++) {
+		for(int i=0; i<3; i++) {
+			mean[i] += rgba[p*4+i] / 16.0f;
+		}
+	}
+	float cov[6] = {0, 0, 0, 0, 0, 0};
+	for(int p=0; p<16; p++) {
+		float r = rgba[p*4+0]-mean[0], g = rgba[p*4+1]-mean[1], b = rgba[p*4+2]-mean[2];
+		cov[0] += r*r; cov[1] += r*g; cov[2] += r*b;
+		cov[3] += g*g; cov[4] += g*b; cov[5] += b*b;
+	}
+	float axis[3] = {1, 1, 1};
+	for(int it=0; it<4; it++) {
+		float x = axis[0]*cov[0] + axis[1]*cov[1] + axis[2]*cov[2];
+		float y = axis[0]*cov[1] + axis[1]*cov[3] + axis[2]*cov[4];
+		float z = axis[0]*cov[2] + axis[1]*cov[4] + axis[2]*cov[5];
+		float m = fmaxf(fabsf(x), fmaxf(fabsf(y), fabsf(z)));
+		if(m < 1e-6f) {
+			break;
+		}
+		axis[0] = x/m; axis[1] = y/m; axis[2] = z/m;
+	}
+	float minp = 1e30f, maxp = -1e30f;
+	int mini = 0, maxi = 0;
+	for(int p=0; p<16; p++) {
+		float d = (rgba[p*4+0]-mean[0])*axis[0] + (rgba[p*4+1]-mean[1])*axis[1] + (rgba[p*4+2]-mean[2])*axis[2];
+		if(d < minp) {
+			minp = d;
+			mini = p;
+		}
+		if(d > maxp) {
+			maxp = d;
+			maxi = p;
+		}
+	}
+	const uint8_t* hi = rgba+maxi*4;
+	const uint8_t* lo = rgba+mini*4;
+	uint16_t c0 = Pack565(hi[0], hi[1], hi[2]), c1 = Pack565(lo[0], lo[1], lo[2]);
+	int pal[4][3], error;
+	ColorPalette(c0, c1, false, pal);
+	uint32_t idx = ColorIndexes(rgba, pal, &error);
+	// weights of c0 for index 0..3 in 4 color mode
+	static const float w0[4] = {1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f};
+	float aa = 0, bb = 0, ab = 0, ax[3] = {0, 0, 0}, bx[3] = {0, 0, 0};
+	for(int p=0; p<16; p++) {
+		float a = w0[(idx >> (p*2)) & 3], b = 1.0f-a;
+		aa += a*a; bb += b*b; ab += a*b;
+		for(int i=0; i<3; i++) {
+			ax[i] += a*rgba[p*4+i];
+			bx[i] += b*rgba[p*4+i];
+		}
+	}
+	float det = aa*bb - ab*ab;
+	if(fabsf(det) > 1e-6f) {
+		float e0[3], e1[3];
+		for(int i=0; i<3; i++) {
+			e0[i] = (ax[i]*bb - bx[i]*ab) / det;
+			e1[i] = (bx[i]*aa - ax[i]*ab) / det;
+		}
+		uint16_t r0 = Pack565(e0[0], e0[1], e0[2]), r1 = Pack565(e1[0], e1[1], e1[2]);
+		int rpal[4][3], rerror;
+		ColorPalette(r0, r1, false, rpal);
+		uint32_t ridx = ColorIndexes(rgba, rpal, &rerror);
+		if(rerror < error) {
+			c0 = r0;
+			c1 = r1;
+			idx = ridx;
+		}
+	}
+	// c0 > c1 selects 4 color mode, swapping endpoints swaps 0-1 and 2-3
+	if(c0 < c1) {
+		uint16_t t = c0;
+		c0 = c1;
+		c1 = t;
+		idx ^= 0x55555555;
+	} else if(c0 == c1) {
+		idx = 0;
+	}
+	out[0] = c0 & 0xFF;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xFF;
+	out[3] = c1 >> 8;
+	memcpy(out+4, &idx, 4);
+}
+
+// 8 level alpha mode, endpoints are block minimum and maximum
+static void CompressAlpha(const uint8_t* rgba, uint8_t* out) {
+	int a0 = 0, a1 = 255;
+	for(int p=0; p<16; p++) {
+		a0 = rgba[p*4+3] > a0 ? rgba[p*4+3] : a0;
+		a1 = rgba[p*4+3] < a1 ? rgba[p*4+3] : a1;
+	}
+	out[0] = a0;
+	out[1] = a1;
+	uint64_t bits = 0;
+	if(a0 > a1) {
+		int pal[8] = {a0, a1};
+		for(int i=1; i<7; i++) {
+			pal[i+1] = ((7-i)*a0 + i*a1) / 7;
+		}
+		for(int p=0; p<16; p++) {
+			int best = 0, bestd = 256;
+			for(int i=0; i<8; i++) {
+				int d = abs(rgba[p*4+3]-pal[i]);
+				if(d < bestd) {
+					bestd = d;
+					best = i;
+				}
+			}
+			bits |= (uint64_t)best << (p*3);
+		}
+	}
+	for(int i=0; i<6; i++) {
+		out[2+i] = (bits >> (i*8)) & 0xFF;
+	}
+}
+
+void CompressBlock(BlockFormat f, const uint8_t* rgba, uint8_t* out) {
+	if(f == BLOCK_BC3) {
+		CompressAlpha(rgba, out);
+		out += 8;
+	}
+	CompressColor(rgba, out);
+}
+
+void DecompressBlock(BlockFormat f, const uint8_t* in, uint8_t* rgba) {
+	const uint8_t* color = f == BLOCK_BC3 ? in+8 : in;
+	uint16_t c0 = color[0] | color[1] << 8, c1 = color[2] | color[3] << 8;
+	uint32_t idx;
+	memcpy(&idx, color+4, 4);
+	int pal[4][3];
+	ColorPalette(c0, c1, f == BLOCK_BC1, pal);
+	for(int p=0; p<16; p++) {
+		int i = (idx >> (p*2)) & 3;
+		rgba[p*4+0] = pal[i][0];
+		rgba[p*4+1] = pal[i][1];
+		rgba[p*4+2] = pal[i][2];
+		rgba[p*4+3] = (f == BLOCK_BC1 && c0 <= c1 && i == 3) ? 0 : 255;
+	}
+	if(f == BLOCK_BC3) {
+		int a0 = in[0], a1 = in[1], pal[8] = {a0, a1};
+		for(int i=1; i<7; i++) {
+			pal[i+1] = a0 > a1 ? ((7-i)*a0 + i*a1) / 7 : i < 5 ? ((5-i)*a0 + i*a1) / 5 : (i == 5 ? 0 : 255);
+		}
+		uint64_t bits = 0;
+		for(int i=0; i<6; i++) {
+			bits |= (uint64_t)in[2+i] << (i*8);
+		}
+		for(int p=0; p<16; p++) {
+			rgba[p*4+3] = pal[(bits >> (p*3)) & 7];
+		}
+	}
+}
+
+void CompressImage(BlockFormat f, const uint8_t* rgba, int w, int h, uint8_t* out) {
+	size_t bsize = f == BLOCK_BC1 ? 8 : 16;
+	uint8_t block[64];
+	for(int by=0; by<h; by+=4) {
+		for(int bx=0; bx<w; bx+=4) {
+			for(int y=0; y<4; y++) {
+				for(int x=0; x<4; x++) {
+					int sx = bx+x < w ? bx+x : w-1, sy = by+y < h ? by+y : h-1;
+					memcpy(block+(y*4+x)*4, rgba+((size_t)sy*w+sx)*4, 4);
+				}
+			}
+			CompressBlock(f, block, out);
+			out += bsize;
+		}
+	}
+}
+
+void DecompressImage(BlockFormat f, const uint8_t* in, int w, int h, uint8_t* rgba) {
+	size_t bsize = f == BLOCK_BC1 ? 8 : 16;
+	uint8_t block[64];
+	for(int by=0; by<h; by+=4) {
+		for(int bx=0; bx<w; bx+=4) {
+			DecompressBlock(f, in, block);
+			in += bsize;
+			for(int y=0; y<4 && by+y<h; y++) {
+				for(int x=0; x<4 && bx+x<w; x++) {
+					memcpy(rgba+((size_t)(by+y)*w+bx+x)*4, block+(y*4+x)*4, 4);
+				}
+			}
+		}
+	}
+}
+
+double ImagePSNR(BlockFormat f, const uint8_t* a, const uint8_t* b, size_t pixels) {
+	int channels = f == BLOCK_BC3 ? 4 : 3;
+	double sum = 0;
+	for(size_t p=0; p<pixels; p++) {
+		for(int c=0; c<channels; c++) {
+			double d = (double)a[p*4+c] - b[p*4+c];
+			sum += d*d;
+		}
+	}
+	double mse = sum / ((double)pixels*channels);
+	return mse == 0 ? INFINITY : 10.0*log10(255.0*255.0/mse);
+}
+
+bool ImageHasAlpha(const uint8_t* rgba, size_t pixels) {
+	for(size_t p=0; p<pixels; p++) {
+		if(rgba[p*4+3] != 255) {
+			return true;
+		}
+	}
+	return false;
+}
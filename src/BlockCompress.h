@@ -0,0 +1,49 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef BLOCKCOMPRESS_H_DEFINED
+#define BLOCKCOMPRESS_H_DEFINED
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CPU encoder of S3TC formats: BC1 (DXT1, opaque, 8 bytes per 4x4
+// block) and BC3 (DXT5, with alpha, 16 bytes per block)
+
+enum BlockFormat {
+	BLOCK_BC1,
+	BLOCK_BC3,
+};
+
+static inline size_t BlockImageSize(BlockFormat f, int w, int h) {
+	return (size_t)((w+3)/4)*((h+3)/4)*(f == BLOCK_BC1 ? 8 : 16);
+}
+// Block of 16 RGBA8 pixels in row order
+void CompressBlock(BlockFormat f, const uint8_t* rgba, uint8_t* out);
+void DecompressBlock(BlockFormat f, const uint8_t* in, uint8_t* rgba);
+// Whole RGBA8 image, edge blocks repeat last row and column
+void CompressImage(BlockFormat f, const uint8_t* rgba, int w, int h, uint8_t* out);
+void DecompressImage(BlockFormat f, const uint8_t* in, int w, int h, uint8_t* rgba);
+// Peak signal to noise ratio in dB over RGB (and alpha for BC3)
+double ImagePSNR(BlockFormat f, const uint8_t* a, const uint8_t* b, size_t pixels);
+// True if any pixel is not fully opaque
+bool ImageHasAlpha(const uint8_t* rgba, size_t pixels);
+
+#endif /* end of include guard: BLOCKCOMPRESS_H_DEFINED */
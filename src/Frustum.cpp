@@ -0,0 +1,46 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "Frustum.h"
+
+void Frustum::FromMatrix(glm::mat4 m) {
+	// glm is column-major, row i is m[0][i] m[1][i] m[2][i] m[3][i]
+	for(int i=0; i<3; i++) {
+		glm::vec4 row(m[0][i], m[1][i], m[2][i], m[3][i]);
+		glm::vec4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+		planes[i*2+0] = w + row;
+		planes[i*2+1] = w - row;
+	}
+}
+
+bool Frustum::IntersectsAABB(glm::vec3 min, glm::vec3 max) const {
+	for(int i=0; i<6; i++) {
+		const glm::vec4 &p = planes[i];
+		// test only corner furthest along plane normal
+		float d = p.w;
+		d += p.x * (p.x >= 0 ? max.x : min.x);
+		d += p.y * (p.y >= 0 ? max.y : min.y);
+		d += p.z * (p.z >= 0 ? max.z : min.z);
+		if(d < 0) {
+			return false;
+		}
+	}
+	return true;
+}
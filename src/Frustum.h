@@ -0,0 +1,35 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef FRUSTUM_H_DEFINED
+#define FRUSTUM_H_DEFINED
+
+#include <glm/glm.hpp>
+
+class Frustum {
+public:
+	glm::vec4 planes[6];
+	// Extracts clip planes from (view) projection matrix
+	void FromMatrix(glm::mat4 m);
+	// Returns false only if box is completely outside of any plane
+	bool IntersectsAABB(glm::vec3 min, glm::vec3 max) const;
+};
+
+#endif /* end of include guard: FRUSTUM_H_DEFINED */
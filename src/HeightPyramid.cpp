@@ -0,0 +1,170 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "HeightPyramid.h"
+
+#include <algorithm>
+
+void HeightPyramid::Build(const TerrainGrid<uint16_t> &heights) {
+	levels.clear();
+	sizes.clear();
+	Size s = {std::max(heights.w-1, 1), std::max(heights.h-1, 1)};
+	while(true) {
+		sizes.push_back(s);
+		levels.emplace_back((size_t)s.w*s.h);
+		if(s.w == 1 && s.h == 1) {
+			break;
+		}
+		s = {(s.w+1)/2, (s.h+1)/2};
+	}
+	Update(heights, 0, 0, sizes[0].w-1, sizes[0].h-1);
+}
+
+void HeightPyramid::Update(const TerrainGrid<uint16_t> &heights, int x0, int y0, int x1, int y1) {
+	if(levels.empty()) {
+		return;
+	}
+	x0 = std::max(x0, 0);
+	y0 = std::max(y0, 0);
+	x1 = std::min(x1, sizes[0].w-1);
+	y1 = std::min(y1, sizes[0].h-1);
+	if(x0 > x1 || y0 > y1) {
+		return;
+	}
+	for(int y=y0; y<=y1; y++) {
+		for(int x=x0; x<=x1; x++) {
+			uint16_t a = heights(x, y), b = heights(x+1, y), c = heights(x, y+1), d = heights(x+1, y+1);
+			levels[0][(size_t)y*sizes[0].w+x] = {std::min(std::min(a, b), std::min(c, d)), std::max(std::max(a, b), std::max(c, d))};
+		}
+	}
+	for(size_t l=1; l<levels.size(); l++) {
+		x0 >>= 1;
+		y0 >>= 1;
+		x1 >>= 1;
+		y1 >>= 1;
+		for(int y=y0; y<=y1; y++) {
+			for(int x=x0; x<=x1; x++) {
+				UpdateNode(l, x, y);
+			}
+		}
+	}
+}
+
+void HeightPyramid::UpdateNode(int level, int x, int y) {
+	const Size &c = sizes[level-1];
+	Bounds b = {0xFFFF, 0};
+	for(int cy=2*y; cy<=2*y+1 && cy<c.h; cy++) {
+		for(int cx=2*x; cx<=2*x+1 && cx<c.w; cx++) {
+			const Bounds &n = Node(level-1, cx, cy);
+			b.min = std::min(b.min, n.min);
+			b.max = std::max(b.max, n.max);
+		}
+	}
+	levels[level][(size_t)y*sizes[level].w+x] = b;
+}
+
+HeightPyramid::Bounds HeightPyramid::Query(int x0, int y0, int x1, int y1) const {
+	Bounds out = {0xFFFF, 0};
+	if(!levels.empty()) {
+		QueryNode(levels.size()-1, 0, 0, x0, y0, x1, y1, out);
+	}
+	return out;
+}
+
+// Nodes inside of rect are taken as is, only ones on its border are
+// split further
+void HeightPyramid::QueryNode(int level, int x, int y, int x0, int y0, int x1, int y1, Bounds &out) const {
+	int nx0 = x << level, ny0 = y << level;
+	int nx1 = std::min(((x+1) << level)-1, sizes[0].w-1), ny1 = std::min(((y+1) << level)-1, sizes[0].h-1);
+	if(nx0 > x1 || ny0 > y1 || nx1 < x0 || ny1 < y0) {
+		return;
+	}
+	const Bounds &n = Node(level, x, y);
+	if(n.min >= out.min && n.max <= out.max) {
+		return;
+	}
+	if(level == 0 || (nx0 >= x0 && ny0 >= y0 && nx1 <= x1 && ny1 <= y1)) {
+		out.min = std::min(out.min, n.min);
+		out.max = std::max(out.max, n.max);
+		return;
+	}
+	const Size &c = sizes[level-1];
+	for(int cy=2*y; cy<=2*y+1 && cy<c.h; cy++) {
+		for(int cx=2*x; cx<=2*x+1 && cx<c.w; cx++) {
+			QueryNode(level-1, cx, cy, x0, y0, x1, y1, out);
+		}
+	}
+}
+
+uint16_t HeightPyramid::Highest(const TerrainGrid<uint16_t> &heights, int x0, int y0, int x1, int y1, int* px, int* py) const {
+	int best = -1;
+	if(!levels.empty()) {
+		HighestNode(heights, levels.size()-1, 0, 0, x0, y0, x1, y1, best, px, py);
+	}
+	return std::max(best, 0);
+}
+
+// Children with higher max go first, nodes that can not beat best found
+// so far are not entered
+void HeightPyramid::HighestNode(const TerrainGrid<uint16_t> &heights, int level, int x, int y, int x0, int y0, int x1, int y1, int &best, int* px, int* py) const {
+	int nx0 = x << level, ny0 = y << level;
+	int nx1 = std::min(((x+1) << level)-1, sizes[0].w-1), ny1 = std::min(((y+1) << level)-1, sizes[0].h-1);
+	if(nx0 > x1 || ny0 > y1 || nx1 < x0 || ny1 < y0 || Node(level, x, y).max <= best) {
+		return;
+	}
+	if(level == 0) {
+		for(int cy=y; cy<=y+1; cy++) {
+			for(int cx=x; cx<=x+1; cx++) {
+				if(heights(cx, cy) > best) {
+					best = heights(cx, cy);
+					*px = cx;
+					*py = cy;
+				}
+			}
+		}
+		return;
+	}
+	const Size &c = sizes[level-1];
+	struct Child {
+		int x, y;
+	} order[4];
+	int count = 0;
+	for(int cy=2*y; cy<=2*y+1 && cy<c.h; cy++) {
+		for(int cx=2*x; cx<=2*x+1 && cx<c.w; cx++) {
+			order[count++] = {cx, cy};
+		}
+	}
+	for(int i=1; i<count; i++) {
+		for(int j=i; j>0 && Node(level-1, order[j].x, order[j].y).max > Node(level-1, order[j-1].x, order[j-1].y).max; j--) {
+			std::swap(order[j], order[j-1]);
+		}
+	}
+	for(int i=0; i<count; i++) {
+		HighestNode(heights, level-1, order[i].x, order[i].y, x0, y0, x1, y1, best, px, py);
+	}
+}
+
+size_t HeightPyramid::NodeCount() const {
+	size_t n = 0;
+	for(auto &l : levels) {
+		n += l.size();
+	}
+	return n;
+}
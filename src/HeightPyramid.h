@@ -0,0 +1,63 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef HEIGHTPYRAMID_H_DEFINED
+#define HEIGHTPYRAMID_H_DEFINED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "TerrainGrid.h"
+
+// Min/max quadtree over tiles of a height plane. Level 0 holds bounds
+// of every tile (its four corners), every next level halves both sides
+// until a single root node is left.
+class HeightPyramid {
+public:
+	struct Bounds {
+		uint16_t min, max;
+	};
+	void Build(const TerrainGrid<uint16_t> &heights);
+	// Recomputes tiles in inclusive rect and their parents up to root
+	void Update(const TerrainGrid<uint16_t> &heights, int x0, int y0, int x1, int y1);
+	// Bounds of tiles in inclusive rect
+	Bounds Query(int x0, int y0, int x1, int y1) const;
+	// Highest map point of tiles in inclusive rect and where it is
+	uint16_t Highest(const TerrainGrid<uint16_t> &heights, int x0, int y0, int x1, int y1, int* px, int* py) const;
+	int Levels() const {
+		return levels.size();
+	}
+	const Bounds& Node(int level, int x, int y) const {
+		return levels[level][(size_t)y*sizes[level].w+x];
+	}
+	size_t NodeCount() const;
+private:
+	struct Size {
+		int w, h;
+	};
+	std::vector<std::vector<Bounds>> levels;
+	std::vector<Size> sizes;
+	void UpdateNode(int level, int x, int y);
+	void QueryNode(int level, int x, int y, int x0, int y0, int x1, int y1, Bounds &out) const;
+	void HighestNode(const TerrainGrid<uint16_t> &heights, int level, int x, int y, int x0, int y0, int x1, int y1, int &best, int* px, int* py) const;
+};
+
+#endif /* end of include guard: HEIGHTPYRAMID_H_DEFINED */
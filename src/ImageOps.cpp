@@ -0,0 +1,199 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "ImageOps.h"
+
+#include <math.h>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+int ImageMipLevels(int w, int h) {
+	int levels = 1;
+	while((w >> levels) > 0 || (h >> levels) > 0) {
+		levels++;
+	}
+	return levels;
+}
+
+// Output pixels x0..dw-1 of row y
+static void DownsampleRowScalar(const uint8_t* src, int w, int h, uint8_t* dst, int y, int x0) {
+	int dw = ImageMipSize(w, 1);
+	// odd or 1 pixel sides reuse the last row or column
+	const uint8_t* r0 = src + (size_t)(2*y < h ? 2*y : h-1)*w*4;
+	const uint8_t* r1 = src + (size_t)(2*y+1 < h ? 2*y+1 : h-1)*w*4;
+	for(int x=x0; x<dw; x++) {
+		int c0 = (2*x < w ? 2*x : w-1)*4, c1 = (2*x+1 < w ? 2*x+1 : w-1)*4;
+		for(int c=0; c<4; c++) {
+			dst[((size_t)y*dw+x)*4+c] = (r0[c0+c] + r0[c1+c] + r1[c0+c] + r1[c1+c] + 2) >> 2;
+		}
+	}
+}
+
+void ImageDownsampleScalar(const uint8_t* src, int w, int h, uint8_t* dst) {
+	int dh = ImageMipSize(h, 1);
+	for(int y=0; y<dh; y++) {
+		DownsampleRowScalar(src, w, h, dst, y, 0);
+	}
+}
+
+#ifdef __SSE2__
+
+// Four output pixels from two rows of eight, sums are done in 16 bits
+// so result is the same as the scalar one
+static void ImageDownsampleSSE2(const uint8_t* src, int w, int h, uint8_t* dst) {
+	int dw = ImageMipSize(w, 1), dh = ImageMipSize(h, 1);
+	const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+	for(int y=0; y<dh; y++) {
+		const uint8_t* r0 = src + (size_t)(2*y < h ? 2*y : h-1)*w*4;
+		const uint8_t* r1 = src + (size_t)(2*y+1 < h ? 2*y+1 : h-1)*w*4;
+		uint8_t* out = dst + (size_t)y*dw*4;
+		int x = 0;
+		for(; x+4 <= w/2; x+=4) {
+			__m128i a0 = _mm_loadu_si128((const __m128i*)(r0+x*8)), a1 = _mm_loadu_si128((const __m128i*)(r0+x*8+16));
+			__m128i b0 = _mm_loadu_si128((const __m128i*)(r1+x*8)), b1 = _mm_loadu_si128((const __m128i*)(r1+x*8+16));
+			// vertical sums, two source pixels per register
+			__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+			__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+			__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+			__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+			__m128i o0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+			__m128i o1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+			o0 = _mm_srli_epi16(_mm_add_epi16(o0, two), 2);
+			o1 = _mm_srli_epi16(_mm_add_epi16(o1, two), 2);
+			_mm_storeu_si128((__m128i*)(out+x*4), _mm_packus_epi16(o0, o1));
+		}
+		DownsampleRowScalar(src, w, h, dst, y, x);
+	}
+}
+
+#endif
+
+void ImageDownsample(const uint8_t* src, int w, int h, uint8_t* dst) {
+#ifdef __SSE2__
+	ImageDownsampleSSE2(src, w, h, dst);
+#else
+	ImageDownsampleScalar(src, w, h, dst);
+#endif
+}
+
+void ImageMipChain(const uint8_t* src, int w, int h, uint8_t* const* levels) {
+	int count = ImageMipLevels(w, h);
+	for(int l=1; l<count; l++) {
+		ImageDownsample(l == 1 ? src : levels[l-1], ImageMipSize(w, l-1), ImageMipSize(h, l-1), levels[l]);
+	}
+}
+
+// Colour channels are moved to 14 bit linear light and back through
+// tables, alpha is only rescaled. Four 14 bit values still fit into 16
+// bits so filtering runs on 16 bit lanes and is exact integer math.
+#define LINEAR_MAX 16383
+
+struct SRGBTables {
+	uint16_t tolinear[2][256]; // colour, alpha
+	uint8_t fromlinear[2][LINEAR_MAX+1];
+	SRGBTables() {
+		for(int i=0; i<256; i++) {
+			double c = i/255.0;
+			double l = c <= 0.04045 ? c/12.92 : pow((c+0.055)/1.055, 2.4);
+			tolinear[0][i] = (uint16_t)lround(l*LINEAR_MAX);
+			tolinear[1][i] = (uint16_t)lround(c*LINEAR_MAX);
+		}
+		for(int i=0; i<=LINEAR_MAX; i++) {
+			double l = (double)i/LINEAR_MAX;
+			double c = l <= 0.0031308 ? l*12.92 : 1.055*pow(l, 1.0/2.4)-0.055;
+			fromlinear[0][i] = (uint8_t)lround(c*255.0);
+			fromlinear[1][i] = (uint8_t)lround(l*255.0);
+		}
+	}
+};
+
+static const SRGBTables& Tables() {
+	static SRGBTables t;
+	return t;
+}
+
+static void HalveLinearRowScalar(const uint16_t* src, int w, int h, uint16_t* dst, int y, int x0) {
+	int dw = ImageMipSize(w, 1);
+	const uint16_t* r0 = src + (size_t)(2*y < h ? 2*y : h-1)*w*4;
+	const uint16_t* r1 = src + (size_t)(2*y+1 < h ? 2*y+1 : h-1)*w*4;
+	for(int x=x0; x<dw; x++) {
+		int c0 = (2*x < w ? 2*x : w-1)*4, c1 = (2*x+1 < w ? 2*x+1 : w-1)*4;
+		for(int c=0; c<4; c++) {
+			dst[((size_t)y*dw+x)*4+c] = (r0[c0+c] + r0[c1+c] + r1[c0+c] + r1[c1+c] + 2) >> 2;
+		}
+	}
+}
+
+static void HalveLinear(const uint16_t* src, int w, int h, uint16_t* dst, bool simd) {
+	int dw = ImageMipSize(w, 1), dh = ImageMipSize(h, 1);
+	for(int y=0; y<dh; y++) {
+		int x = 0;
+#ifdef __SSE2__
+		if(simd) {
+			const uint16_t* r0 = src + (size_t)(2*y < h ? 2*y : h-1)*w*4;
+			const uint16_t* r1 = src + (size_t)(2*y+1 < h ? 2*y+1 : h-1)*w*4;
+			uint16_t* out = dst + (size_t)y*dw*4;
+			const __m128i two = _mm_set1_epi16(2);
+			// two output pixels from two rows of four, sums stay below 2^16
+			for(; x+2 <= w/2; x+=2) {
+				__m128i s0 = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(r0+x*8)), _mm_loadu_si128((const __m128i*)(r1+x*8)));
+				__m128i s1 = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(r0+x*8+8)), _mm_loadu_si128((const __m128i*)(r1+x*8+8)));
+				__m128i o = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+				_mm_storeu_si128((__m128i*)(out+x*4), _mm_srli_epi16(_mm_add_epi16(o, two), 2));
+			}
+		}
+#endif
+		HalveLinearRowScalar(src, w, h, dst, y, x);
+	}
+}
+
+static void DownsampleSRGB(const uint8_t* src, int w, int h, int steps, uint8_t* dst, bool simd) {
+	const SRGBTables &t = Tables();
+	std::vector<uint16_t> cur((size_t)w*h*4), next;
+	for(size_t i=0; i<cur.size(); i+=4) {
+		cur[i+0] = t.tolinear[0][src[i+0]];
+		cur[i+1] = t.tolinear[0][src[i+1]];
+		cur[i+2] = t.tolinear[0][src[i+2]];
+		cur[i+3] = t.tolinear[1][src[i+3]];
+	}
+	for(int s=0; s<steps; s++) {
+		int lw = ImageMipSize(w, s), lh = ImageMipSize(h, s);
+		next.resize((size_t)ImageMipSize(w, s+1)*ImageMipSize(h, s+1)*4);
+		HalveLinear(cur.data(), lw, lh, next.data(), simd);
+		cur.swap(next);
+	}
+	for(size_t i=0; i<cur.size(); i+=4) {
+		dst[i+0] = t.fromlinear[0][cur[i+0]];
+		dst[i+1] = t.fromlinear[0][cur[i+1]];
+		dst[i+2] = t.fromlinear[0][cur[i+2]];
+		dst[i+3] = t.fromlinear[1][cur[i+3]];
+	}
+}
+
+void ImageDownsampleSRGB(const uint8_t* src, int w, int h, int steps, uint8_t* dst) {
+	DownsampleSRGB(src, w, h, steps, dst, true);
+}
+
+void ImageDownsampleSRGBScalar(const uint8_t* src, int w, int h, int steps, uint8_t* dst) {
+	DownsampleSRGB(src, w, h, steps, dst, false);
+}
@@ -0,0 +1,45 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef IMAGEOPS_H_DEFINED
+#define IMAGEOPS_H_DEFINED
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Images here are tightly packed RGBA8
+
+// Count of levels in full mip chain down to 1x1
+int ImageMipLevels(int w, int h);
+static inline int ImageMipSize(int size, int level) {
+	return size >> level > 0 ? size >> level : 1;
+}
+// Box filters src into dst of half size (at least 1 pixel), SSE2 when
+// available, both versions give the same result
+void ImageDownsample(const uint8_t* src, int w, int h, uint8_t* dst);
+void ImageDownsampleScalar(const uint8_t* src, int w, int h, uint8_t* dst);
+// Halves sRGB src steps times, averaging is done in linear light with
+// integer math only so result is the same on every run and machine
+void ImageDownsampleSRGB(const uint8_t* src, int w, int h, int steps, uint8_t* dst);
+void ImageDownsampleSRGBScalar(const uint8_t* src, int w, int h, int steps, uint8_t* dst);
+// Fills levels[1..] with the whole mip chain of src, levels[0] unused
+void ImageMipChain(const uint8_t* src, int w, int h, uint8_t* const* levels);
+
+#endif /* end of include guard: IMAGEOPS_H_DEFINED */
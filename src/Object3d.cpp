@@ -24,6 +24,8 @@
 
 #include "log.hpp"
 
+static const ShaderHandle UModel = ShaderUniform("Model");
+
 Object3d::Object3d() {
 	GLvertexes = NULL;
 	GLpos = {0.0f, 0.0f, 0.0f};
@@ -135,7 +137,7 @@ void Object3d::PrepareTextureCoords() {
 }
 
 // Makes up buffers and stores arrays
-void Object3d::BufferData(unsigned int shader) {
+void Object3d::BufferData(Shader* shader) {
 	glGenVertexArrays(1, &VAOv);
 	glGenBuffers(1, &VBOv);
 	BindVAO();
@@ -144,10 +146,12 @@ void Object3d::BufferData(unsigned int shader) {
 	// 	printf("%f %f %f %f %f\n", GLvertexes[i], GLvertexes[i+1], GLvertexes[i+2], GLvertexes[i+3], GLvertexes[i+4]);
 	// }
 	glBufferData(GL_ARRAY_BUFFER, GLvertexesCount*sizeof(float), GLvertexes, GL_STATIC_DRAW);
-	glVertexAttribPointer(glGetAttribLocation(shader, "VertexCoordinates"), 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(glGetAttribLocation(shader, "VertexCoordinates"));
-	glVertexAttribPointer(glGetAttribLocation(shader, "TextureCoordinates"), 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(glGetAttribLocation(shader, "TextureCoordinates"));
+	int vertexloc = shader->Attribute("VertexCoordinates");
+	int texloc = shader->Attribute("TextureCoordinates");
+	glVertexAttribPointer(vertexloc, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(vertexloc);
+	glVertexAttribPointer(texloc, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(texloc);
 }
 
 void Object3d::BindVAO() {
@@ -165,12 +169,12 @@ glm::mat4 Object3d::GetMatrix() {
 		glm::mat4(1);
 }
 
-void Object3d::Render(unsigned int shader) {
+void Object3d::Render(Shader* shader) {
 	if(UsingTexture != nullptr) {
 		UsingTexture->Bind(UsingTexture->id);
 		// glUniform1i(glGetUniformLocation(shader, "Texture"), UsingTexture->id);
 	}
-	glUniformMatrix4fv(glGetUniformLocation(shader, "Model"), 1, GL_FALSE, glm::value_ptr(GetMatrix()));
+	shader->Set(UModel, GetMatrix());
 	BindVAO();
 	BindVBO();
 	if(FillTextures) {
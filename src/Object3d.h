@@ -29,6 +29,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "Texture.h"
+#include "Shader.h"
 
 class Object3d {
 public:
@@ -46,11 +47,11 @@ public:
 	Object3d();
 	bool LoadFromPIE(std::string filepath);
 	void PrepareTextureCoords();
-	void BufferData(unsigned int shader);
+	void BufferData(Shader* shader);
 	void BindVAO();
 	void BindVBO();
 	glm::mat4 GetMatrix();
-	void Render(unsigned int shader);
+	void Render(Shader* shader);
 	void Free();
 };
 
@@ -0,0 +1,46 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "PerFrame.h"
+
+static_assert(sizeof(PerFrameData) == 112, "PerFrameData must match std140 layout of PerFrame block");
+
+void PerFrame::Update() {
+	if(!UBO) {
+		glGenBuffers(1, &UBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(PerFrameData), NULL, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_PERFRAME_BINDING, UBO);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PerFrameData), &Data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void PerFrame::Free() {
+	if(UBO) {
+		glDeleteBuffers(1, &UBO);
+	}
+	UBO = 0;
+}
+
+PerFrame::~PerFrame() {
+	Free();
+}
@@ -0,0 +1,49 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef PERFRAME_H_INCLUDED
+#define PERFRAME_H_INCLUDED
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+
+// Mirror of std140 block PerFrame declared by shaders, every Shader with
+// it is bound to SHADER_PERFRAME_BINDING. Keep members vec4 aligned.
+struct PerFrameData {
+	glm::mat4 ViewProjection;
+	glm::vec4 CameraPosition; // w unused
+	glm::vec4 Viewport; // x, y, width, height in pixels
+	float Time; // seconds since start
+	float pad[3];
+};
+
+// Uniform buffer updated once per frame and shared by all programs
+class PerFrame {
+public:
+	PerFrameData Data;
+	void Update();
+	void Free();
+	~PerFrame();
+private:
+	unsigned int UBO = 0;
+};
+
+#endif /* end of include guard: PERFRAME_H_INCLUDED */
@@ -0,0 +1,162 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "PickBuffer.h"
+#include "log.hpp"
+
+void PickBuffer::Resize(int width, int height) {
+	if(FBO && width == Width && height == Height) {
+		return;
+	}
+	if(!FBO) {
+		glGenFramebuffers(1, &FBO);
+		glGenTextures(1, &IdTex);
+		glGenRenderbuffers(1, &DepthRBO);
+	}
+	Width = width;
+	Height = height;
+	glBindTexture(GL_TEXTURE_2D, IdTex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindRenderbuffer(GL_RENDERBUFFER, DepthRBO);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, IdTex, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, DepthRBO);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		log_error("Pick framebuffer incomplete");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	for(int i = 0; i < RingSize; i++) {
+		if(!Ring[i].pbo) {
+			glGenBuffers(1, &Ring[i].pbo);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, Ring[i].pbo);
+			glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(unsigned int), NULL, GL_STREAM_READ);
+		}
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+bool PickBuffer::Begin(int width, int height, int x, int y) {
+	if(width <= 0 || height <= 0 || x < 0 || y < 0 || x >= width || y >= height) {
+		return false;
+	}
+	Resize(width, height);
+	// skip frame rather than wait for oldest readback
+	Current = -1;
+	for(int i = 0; i < RingSize; i++) {
+		if(!Ring[i].fence) {
+			Current = i;
+			break;
+		}
+	}
+	if(Current < 0) {
+		return false;
+	}
+	X = x;
+	Y = height - 1 - y;
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glViewport(0, 0, width, height);
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(X, Y, 1, 1);
+	// main pass clears depth to 0, ids need a regular depth test
+	// whatever state caller left
+	SavedDepthTest = glIsEnabled(GL_DEPTH_TEST);
+	glGetFloatv(GL_DEPTH_CLEAR_VALUE, &SavedClearDepth);
+	glGetIntegerv(GL_DEPTH_FUNC, &SavedDepthFunc);
+	glEnable(GL_DEPTH_TEST);
+	glClearDepth(1.0);
+	glDepthFunc(GL_LESS);
+	GLuint none[4] = {PICK_NONE, 0, 0, 0};
+	glClearBufferuiv(GL_COLOR, 0, none);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	return true;
+}
+
+void PickBuffer::End() {
+	Readback &r = Ring[Current];
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(X, Y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	r.frame = ++Frame;
+	glClearDepth(SavedClearDepth);
+	glDepthFunc(SavedDepthFunc);
+	if(!SavedDepthTest) {
+		glDisable(GL_DEPTH_TEST);
+	}
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, Width, Height);
+}
+
+bool PickBuffer::Poll(unsigned int* id) {
+	unsigned int newest = 0;
+	for(int i = 0; i < RingSize; i++) {
+		Readback &r = Ring[i];
+		if(!r.fence) {
+			continue;
+		}
+		GLenum s = glClientWaitSync(r.fence, 0, 0);
+		if(s != GL_ALREADY_SIGNALED && s != GL_CONDITION_SATISFIED) {
+			continue;
+		}
+		glDeleteSync(r.fence);
+		r.fence = 0;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+		unsigned int* p = (unsigned int*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(unsigned int), GL_MAP_READ_BIT);
+		if(p != NULL) {
+			if(r.frame > newest) {
+				newest = r.frame;
+				*id = *p;
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return newest != 0;
+}
+
+void PickBuffer::Free() {
+	for(int i = 0; i < RingSize; i++) {
+		if(Ring[i].fence) {
+			glDeleteSync(Ring[i].fence);
+		}
+		if(Ring[i].pbo) {
+			glDeleteBuffers(1, &Ring[i].pbo);
+		}
+		Ring[i] = Readback();
+	}
+	if(FBO) {
+		glDeleteFramebuffers(1, &FBO);
+		glDeleteTextures(1, &IdTex);
+		glDeleteRenderbuffers(1, &DepthRBO);
+	}
+	FBO = IdTex = DepthRBO = 0;
+	Width = Height = 0;
+}
+
+PickBuffer::~PickBuffer() {
+	Free();
+}
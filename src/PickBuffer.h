@@ -0,0 +1,65 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef PICKBUFFER_H_INCLUDED
+#define PICKBUFFER_H_INCLUDED
+
+#include "glad/glad.h"
+
+// Id of whatever is drawn under a pixel: 0 is nothing, terrain tiles are
+// y*w+x+1 and objects have PICK_OBJECT_BIT set over their index+1
+#define PICK_NONE 0u
+#define PICK_OBJECT_BIT 0x80000000u
+
+// Offscreen integer id buffer. Only the pixel under the cursor is
+// rendered (scissor) and it is read back through a ring of pixel
+// buffers guarded by fences, so result arrives a frame or two later
+// without ever stalling on the GPU
+class PickBuffer {
+public:
+	static const int RingSize = 3;
+	// Binds id framebuffer and scissors it to window pixel x, y
+	// (top left origin), false if readback ring is full this frame
+	bool Begin(int width, int height, int x, int y);
+	// Queues readback of the pixel and restores default framebuffer
+	void End();
+	// Newest finished readback, false if none finished since last call
+	bool Poll(unsigned int* id);
+	void Free();
+	~PickBuffer();
+private:
+	struct Readback {
+		unsigned int pbo = 0;
+		GLsync fence = 0;
+		unsigned int frame = 0;
+	};
+	unsigned int FBO = 0, IdTex = 0, DepthRBO = 0;
+	int Width = 0, Height = 0;
+	int X = 0, Y = 0;
+	Readback Ring[RingSize];
+	unsigned int Frame = 0;
+	int Current = -1;
+	float SavedClearDepth = 0.0f;
+	int SavedDepthFunc = GL_LESS;
+	bool SavedDepthTest = true;
+	void Resize(int width, int height);
+};
+
+#endif /* end of include guard: PICKBUFFER_H_INCLUDED */
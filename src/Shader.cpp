@@ -22,9 +22,28 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <glm/gtc/type_ptr.hpp>
+
 #include "Shader.h"
 #include "log.hpp"
 
+static std::vector<std::string>& ShaderUniformNames() {
+	static std::vector<std::string> names;
+	return names;
+}
+
+ShaderHandle ShaderUniform(const char* name) {
+	std::vector<std::string> &names = ShaderUniformNames();
+	for(size_t i=0; i<names.size(); i++) {
+		if(names[i] == name) {
+			return i;
+		}
+	}
+	names.push_back(name);
+	return names.size()-1;
+}
+
 Shader::Shader(const GLchar* vp, const GLchar* fp) {
 	FILE *vf = fopen(vp, "r"), *ff = fopen(fp, "r");
 	if(vf == NULL) {
@@ -98,7 +117,8 @@ Shader::Shader(const GLchar* vp, const GLchar* fp) {
 	glDetachShader(this->program, f);
 	glDeleteShader(v);
 	glDeleteShader(f);
-	log_info("Shader [%s] [%s] loaded.", vp, fp);
+	Reflect();
+	log_info("Shader [%s] [%s] loaded, %d uniforms, %d attributes.", vp, fp, (int)Uniforms.size(), (int)Attributes.size());
 	free(vcode);
 	free(fcode);
 }
@@ -107,6 +127,116 @@ void Shader::use() {
 	glUseProgram(this->program);
 }
 
+void Shader::Reflect() {
+	GLint count = 0, maxlen = 0;
+	std::vector<GLchar> name;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxlen);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	name.resize(maxlen+1);
+	for(GLint i=0; i<count; i++) {
+		ShaderVariable v;
+		glGetActiveUniform(program, i, name.size(), NULL, &v.size, &v.type, name.data());
+		v.location = glGetUniformLocation(program, name.data());
+		if(v.location < 0) {
+			continue; // block members have no location
+		}
+		v.name = name.data();
+		if(v.name.size() > 3 && v.name.compare(v.name.size()-3, 3, "[0]") == 0) {
+			v.name.resize(v.name.size()-3);
+		}
+		Uniforms.push_back(v);
+	}
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxlen);
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+	name.resize(maxlen+1);
+	for(GLint i=0; i<count; i++) {
+		ShaderVariable v;
+		glGetActiveAttrib(program, i, name.size(), NULL, &v.size, &v.type, name.data());
+		v.location = glGetAttribLocation(program, name.data());
+		if(v.location < 0) {
+			continue; // gl_VertexID and friends
+		}
+		v.name = name.data();
+		Attributes.push_back(v);
+	}
+	GLuint block = glGetUniformBlockIndex(program, "PerFrame");
+	if(block != GL_INVALID_INDEX) {
+		glUniformBlockBinding(program, block, SHADER_PERFRAME_BINDING);
+	}
+	auto byname = [] (const ShaderVariable &a, const ShaderVariable &b) {
+		return a.name < b.name;
+	};
+	std::sort(Uniforms.begin(), Uniforms.end(), byname);
+	std::sort(Attributes.begin(), Attributes.end(), byname);
+}
+
+static const ShaderVariable* FindVariable(const std::vector<ShaderVariable> &vars, const std::string &name) {
+	auto it = std::lower_bound(vars.begin(), vars.end(), name, [] (const ShaderVariable &v, const std::string &n) {
+		return v.name < n;
+	});
+	if(it == vars.end() || it->name != name) {
+		return nullptr;
+	}
+	return &*it;
+}
+
+int Shader::Attribute(const char* name) {
+	const ShaderVariable* v = FindVariable(Attributes, name);
+	return v ? v->location : -1;
+}
+
+int Shader::Location(ShaderHandle h) {
+	const int unresolved = -2;
+	if((size_t)h >= Locations.size()) {
+		Locations.resize(h+1, unresolved);
+	}
+	if(Locations[h] == unresolved) {
+		const ShaderVariable* v = FindVariable(Uniforms, ShaderUniformNames()[h]);
+		Locations[h] = v ? v->location : -1;
+	}
+	return Locations[h];
+}
+
+void Shader::Set(ShaderHandle h, int v) {
+	glUniform1i(Location(h), v);
+}
+
+void Shader::Set(ShaderHandle h, unsigned int v) {
+	glUniform1ui(Location(h), v);
+}
+
+void Shader::Set(ShaderHandle h, float v) {
+	glUniform1f(Location(h), v);
+}
+
+void Shader::Set(ShaderHandle h, glm::vec2 v) {
+	glUniform2f(Location(h), v.x, v.y);
+}
+
+void Shader::Set(ShaderHandle h, glm::ivec2 v) {
+	glUniform2i(Location(h), v.x, v.y);
+}
+
+void Shader::Set(ShaderHandle h, glm::ivec3 v) {
+	glUniform3i(Location(h), v.x, v.y, v.z);
+}
+
+void Shader::Set(ShaderHandle h, const glm::mat4 &v) {
+	glUniformMatrix4fv(Location(h), 1, GL_FALSE, glm::value_ptr(v));
+}
+
+void Shader::Set(ShaderHandle h, const int* v, int count) {
+	glUniform1iv(Location(h), count, v);
+}
+
+void Shader::Set(ShaderHandle h, const float* v, int count) {
+	glUniform1fv(Location(h), count, v);
+}
+
+void Shader::Set(ShaderHandle h, const glm::vec4* v, int count) {
+	glUniform4fv(Location(h), count, glm::value_ptr(v[0]));
+}
+
 Shader::~Shader() {
 	glDeleteProgram(this->program);
 }
@@ -24,12 +24,53 @@
 #include "glad/glad.h"
 #include <GL/gl.h>
 #include <GL/glu.h>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Uniform buffer binding point of std140 block PerFrame, see PerFrame.h
+#define SHADER_PERFRAME_BINDING 0
+
+// Uniform names are interned once into small handles shared by all
+// programs, keep them in statics and pass to Shader::Set
+typedef int ShaderHandle;
+ShaderHandle ShaderUniform(const char* name);
+
+// Active uniform or attribute as reflected after linking, arrays are
+// stored without [0] suffix
+struct ShaderVariable {
+	std::string name;
+	int location;
+	GLenum type;
+	int size;
+};
 
 class Shader {
 public:
 	unsigned int program;
+	std::vector<ShaderVariable> Uniforms; // sorted by name
+	std::vector<ShaderVariable> Attributes; // sorted by name
 	Shader(const char* vp, const char* fp);
 	~Shader();
 	void use();
+	// Location of active attribute or -1, meant for vertex array setup
+	int Attribute(const char* name);
+	// Setters of uniforms of this program (it has to be in use),
+	// uniforms optimized out of the program are skipped
+	void Set(ShaderHandle h, int v);
+	void Set(ShaderHandle h, unsigned int v);
+	void Set(ShaderHandle h, float v);
+	void Set(ShaderHandle h, glm::vec2 v);
+	void Set(ShaderHandle h, glm::ivec2 v);
+	void Set(ShaderHandle h, glm::ivec3 v);
+	void Set(ShaderHandle h, const glm::mat4 &v);
+	void Set(ShaderHandle h, const int* v, int count);
+	void Set(ShaderHandle h, const float* v, int count);
+	void Set(ShaderHandle h, const glm::vec4* v, int count);
+private:
+	// Uniform location per handle, resolved on first use
+	std::vector<int> Locations;
+	void Reflect();
+	int Location(ShaderHandle h);
 };
 #endif
@@ -0,0 +1,53 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef TERRAINGRID_H_DEFINED
+#define TERRAINGRID_H_DEFINED
+
+#include <stddef.h>
+#include <vector>
+
+// Map sized 2d array, stored row-major same as WZmap::mapheight
+template <typename T>
+class TerrainGrid {
+public:
+	int w = 0, h = 0;
+	std::vector<T> data;
+	// Drops old contents and memory, new cells are value-initialized
+	void Resize(int nw, int nh) {
+		w = nw;
+		h = nh;
+		std::vector<T>((size_t)w*h).swap(data);
+	}
+	T& operator()(int x, int y) {
+		return data[(size_t)y*w+x];
+	}
+	const T& operator()(int x, int y) const {
+		return data[(size_t)y*w+x];
+	}
+	T* Row(int y) {
+		return data.data()+(size_t)y*w;
+	}
+	size_t Size() const {
+		return data.size();
+	}
+};
+
+#endif /* end of include guard: TERRAINGRID_H_DEFINED */
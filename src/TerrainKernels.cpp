@@ -0,0 +1,170 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "TerrainKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TERRAIN_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+static void PositionsScalar(TerrainVertex* out, const uint16_t* h0, const uint16_t* h1, int x, int y, int count) {
+	for(int i=0; i<count; i++) {
+		TerrainVertex* v = out + i*4;
+		v[0].x = x+i;   v[0].y = y;   v[0].height = h0[i];
+		v[1].x = x+i+1; v[1].y = y;   v[1].height = h0[i+1];
+		v[2].x = x+i+1; v[2].y = y+1; v[2].height = h1[i+1];
+		v[3].x = x+i;   v[3].y = y+1; v[3].height = h1[i];
+	}
+}
+
+static void IndexesScalar(unsigned int* out, const uint32_t* bits, unsigned int base, int count) {
+	for(int i=0; i<count; i++) {
+		const uint8_t* p = TileOrientationOf(bits[i]).index;
+		for(int j=0; j<6; j++) {
+			out[i*6+j] = base + i*4 + p[j];
+		}
+	}
+}
+
+const TerrainRowKernel TerrainKernelScalar = {"scalar", PositionsScalar, IndexesScalar};
+
+#ifdef TERRAIN_KERNELS_X86
+
+// Every 64 bit lane holds [x y height 0] of one vertex, the zero lands
+// on layer and is overwritten by texture pass later
+static inline void StoreCorner(TerrainVertex* v, __m128i c) {
+	_mm_storel_epi64((__m128i*)v, c);
+	_mm_storel_epi64((__m128i*)(v+4), _mm_unpackhi_epi64(c, c));
+}
+
+// Two tiles worth of one corner: x and y are 16 bit pairs in 32 bit
+// lanes, heights are zero extended to 32 bit
+static inline void StoreCorners(TerrainVertex* v, __m128i xy, __m128i h) {
+	StoreCorner(v, _mm_unpacklo_epi32(xy, h));
+	StoreCorner(v+8, _mm_unpackhi_epi32(xy, h));
+}
+
+static void PositionsSSE2(TerrainVertex* out, const uint16_t* h0, const uint16_t* h1, int x, int y, int count) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i y0 = _mm_set1_epi32(y << 16), y1 = _mm_set1_epi32((y+1) << 16);
+	const __m128i step = _mm_setr_epi32(0, 1, 2, 3);
+	int i = 0;
+	// last block reads up to h[i+4], which is still inside the row
+	for(; i+4<=count; i+=4) {
+		__m128i xl = _mm_add_epi32(_mm_set1_epi32(x+i), step);
+		__m128i xr = _mm_add_epi32(xl, _mm_set1_epi32(1));
+		__m128i htl = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(h0+i)), zero);
+		__m128i htr = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(h0+i+1)), zero);
+		__m128i hbr = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(h1+i+1)), zero);
+		__m128i hbl = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(h1+i)), zero);
+		TerrainVertex* v = out + i*4;
+		StoreCorners(v+0, _mm_or_si128(xl, y0), htl);
+		StoreCorners(v+1, _mm_or_si128(xr, y0), htr);
+		StoreCorners(v+2, _mm_or_si128(xr, y1), hbr);
+		StoreCorners(v+3, _mm_or_si128(xl, y1), hbl);
+	}
+	PositionsScalar(out + i*4, h0+i, h1+i, x+i, y, count-i);
+}
+
+// Two tiles (12 indexes) per iteration, pattern is picked by triflip mask
+static void IndexesSSE2(unsigned int* out, const uint32_t* bits, unsigned int base, int count) {
+	const __m128i s0 = _mm_setr_epi32(0, 1, 2, 0), s1 = _mm_setr_epi32(3, 2, 0, 1), s2 = _mm_setr_epi32(2, 0, 3, 2);
+	const __m128i f0 = _mm_setr_epi32(3, 0, 1, 3), f1 = _mm_setr_epi32(2, 1, 3, 0), f2 = _mm_setr_epi32(1, 3, 2, 1);
+	int i = 0;
+	for(; i+2<=count; i+=2) {
+		int m0 = -(int)TileTriFlip(bits[i]), m1 = -(int)TileTriFlip(bits[i+1]);
+		unsigned int b0 = base+i*4, b1 = b0+4;
+		__m128i mask0 = _mm_set1_epi32(m0), mask1 = _mm_setr_epi32(m0, m0, m1, m1), mask2 = _mm_set1_epi32(m1);
+		__m128i base0 = _mm_set1_epi32(b0), base1 = _mm_setr_epi32(b0, b0, b1, b1), base2 = _mm_set1_epi32(b1);
+		__m128i* o = (__m128i*)(out+i*6);
+		_mm_storeu_si128(o+0, _mm_add_epi32(base0, _mm_or_si128(_mm_and_si128(mask0, f0), _mm_andnot_si128(mask0, s0))));
+		_mm_storeu_si128(o+1, _mm_add_epi32(base1, _mm_or_si128(_mm_and_si128(mask1, f1), _mm_andnot_si128(mask1, s1))));
+		_mm_storeu_si128(o+2, _mm_add_epi32(base2, _mm_or_si128(_mm_and_si128(mask2, f2), _mm_andnot_si128(mask2, s2))));
+	}
+	IndexesScalar(out+i*6, bits+i, base+i*4, count-i);
+}
+
+// Eight tiles worth of one corner, 128 bit lanes hold tiles 0-3 and 4-7
+__attribute__((target("avx2")))
+static inline void StoreCornersAVX2(TerrainVertex* v, __m256i xy, __m256i h) {
+	__m256i lo = _mm256_unpacklo_epi32(xy, h), hi = _mm256_unpackhi_epi32(xy, h);
+	StoreCorner(v, _mm256_castsi256_si128(lo));
+	StoreCorner(v+8, _mm256_castsi256_si128(hi));
+	StoreCorner(v+16, _mm256_extracti128_si256(lo, 1));
+	StoreCorner(v+24, _mm256_extracti128_si256(hi, 1));
+}
+
+__attribute__((target("avx2")))
+static void PositionsAVX2(TerrainVertex* out, const uint16_t* h0, const uint16_t* h1, int x, int y, int count) {
+	const __m256i y0 = _mm256_set1_epi32(y << 16), y1 = _mm256_set1_epi32((y+1) << 16);
+	const __m256i step = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	int i = 0;
+	// 16 byte load at h[i+1] ends at h[i+8], still inside the row
+	for(; i+8<=count; i+=8) {
+		__m256i xl = _mm256_add_epi32(_mm256_set1_epi32(x+i), step);
+		__m256i xr = _mm256_add_epi32(xl, _mm256_set1_epi32(1));
+		__m256i htl = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(h0+i)));
+		__m256i htr = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(h0+i+1)));
+		__m256i hbr = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(h1+i+1)));
+		__m256i hbl = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(h1+i)));
+		TerrainVertex* v = out + i*4;
+		StoreCornersAVX2(v+0, _mm256_or_si256(xl, y0), htl);
+		StoreCornersAVX2(v+1, _mm256_or_si256(xr, y0), htr);
+		StoreCornersAVX2(v+2, _mm256_or_si256(xr, y1), hbr);
+		StoreCornersAVX2(v+3, _mm256_or_si256(xl, y1), hbl);
+	}
+	PositionsSSE2(out + i*4, h0+i, h1+i, x+i, y, count-i);
+}
+
+const TerrainRowKernel TerrainKernelSSE2 = {"sse2", PositionsSSE2, IndexesSSE2};
+const TerrainRowKernel TerrainKernelAVX2 = {"avx2", PositionsAVX2, IndexesSSE2};
+
+#else
+
+const TerrainRowKernel TerrainKernelSSE2 = {"sse2", nullptr, nullptr};
+const TerrainRowKernel TerrainKernelAVX2 = {"avx2", nullptr, nullptr};
+
+#endif
+
+bool TerrainKernelSupported(const TerrainRowKernel* k) {
+	if(k->positions == nullptr) {
+		return false;
+	}
+#ifdef TERRAIN_KERNELS_X86
+	if(k == &TerrainKernelSSE2) {
+		return __builtin_cpu_supports("sse2");
+	}
+	if(k == &TerrainKernelAVX2) {
+		return __builtin_cpu_supports("avx2");
+	}
+#endif
+	return true;
+}
+
+const TerrainRowKernel* TerrainBestKernel() {
+	const TerrainRowKernel* k[] = {&TerrainKernelAVX2, &TerrainKernelSSE2};
+	for(auto i : k) {
+		if(TerrainKernelSupported(i)) {
+			return i;
+		}
+	}
+	return &TerrainKernelScalar;
+}
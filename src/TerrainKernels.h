@@ -0,0 +1,136 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef TERRAINKERNELS_H_DEFINED
+#define TERRAINKERNELS_H_DEFINED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Packed terrain vertex: map point coordinates, raw height, tile
+   texture array layer, normalized coordinates inside of the layer and
+   TERRAIN_VERTEX_* flags */
+struct TerrainVertex {
+	int16_t x, y;
+	uint16_t height;
+	uint16_t layer;
+	uint8_t u, v;
+	uint8_t flags;
+	uint8_t pad;
+};
+static_assert(sizeof(TerrainVertex) == 12, "TerrainVertex has to be packed");
+
+#define TERRAIN_VERTEX_CLIFF 1
+
+/* World units per map height unit */
+#define TERRAIN_HEIGHT_SCALE 4.0f
+
+/* The shift on a world coordinate to get the tile coordinate */
+#define TILE_SHIFT 7
+static inline int32_t world_coord(int32_t mapCoord) { return (uint32_t)mapCoord << TILE_SHIFT; }
+static inline int32_t map_coord(int32_t worldCoord) { return worldCoord >> TILE_SHIFT; }
+
+/* Packed tile: texture 0-8, rotation 9-10, x flip 11, y flip 12,
+   triflip 13, terrain type 14-17 */
+static inline uint32_t TilePack(int texture, int rot, bool fx, bool fy, bool triflip, int tt) {
+	return (texture & 0x1FF) | (rot & 3) << 9 | fx << 11 | fy << 12 | triflip << 13 | (tt & 0xF) << 14;
+}
+static inline int TileTexture(uint32_t t) { return t & 0x1FF; }
+static inline int TileRotation(uint32_t t) { return (t >> 9) & 3; }
+static inline bool TileXFlip(uint32_t t) { return (t >> 11) & 1; }
+static inline bool TileYFlip(uint32_t t) { return (t >> 12) & 1; }
+static inline bool TileTriFlip(uint32_t t) { return (t >> 13) & 1; }
+
+
+// Mesh generation for one continuous row of tiles [x, x+count) of tile
+// row y. h0 and h1 point at heights of map rows y and y+1 starting from
+// column x (count+1 values each), bits at packed tiles of row y.
+struct TerrainRowKernel {
+	const char* name;
+	// Positions (x, y, height) of 4 corners per tile. Two bytes right
+	// after position may be overwritten, texture coordinates are
+	// expected to be written after positions.
+	void (*positions)(TerrainVertex* out, const uint16_t* h0, const uint16_t* h1, int x, int y, int count);
+	// 6 indexes per tile following tile triflip, base is first vertex
+	void (*indexes)(unsigned int* out, const uint32_t* bits, unsigned int base, int count);
+};
+
+// Tile orientation is packed bits 9-13 (rotation, x flip, y flip,
+// triflip), see TilePack
+struct TileOrientation {
+	uint8_t corner[4]; // texture corner shown at tile corner
+	uint8_t index[6]; // tile corners of both triangles
+};
+struct TileOrientationTable {
+	TileOrientation o[32];
+};
+constexpr TileOrientationTable MakeTileOrientations() {
+	// 0 1
+	// 3 2
+	const uint8_t straight[6] = {0, 1, 2, 0, 3, 2};
+	const uint8_t flipped[6] = {3, 0, 1, 3, 2, 1};
+	TileOrientationTable t = {};
+	for(int i=0; i<32; i++) {
+		int rot = i & 3;
+		bool fx = (i >> 2) & 1, fy = (i >> 3) & 1, triflip = (i >> 4) & 1;
+		for(int c=0; c<4; c++) {
+			// rotation walks corners backwards, x flip swaps 0-1 and
+			// 3-2, y flip swaps 0-3 and 1-2
+			int k = (c - rot) & 3;
+			if(fx) {
+				k ^= 1;
+			}
+			if(fy) {
+				k = 3 - k;
+			}
+			t.o[i].corner[c] = k;
+		}
+		for(int j=0; j<6; j++) {
+			t.o[i].index[j] = triflip ? flipped[j] : straight[j];
+		}
+	}
+	return t;
+}
+inline constexpr TileOrientationTable TileOrientations = MakeTileOrientations();
+static inline const TileOrientation& TileOrientationOf(uint32_t bits) {
+	return TileOrientations.o[(bits >> 9) & 0x1F];
+}
+
+extern const TerrainRowKernel TerrainKernelScalar;
+extern const TerrainRowKernel TerrainKernelSSE2;
+extern const TerrainRowKernel TerrainKernelAVX2;
+
+// Kernels only own x, y and height of a vertex: SIMD ones store a zero
+// into the field after height (layer), which texture pass fills later,
+// so only positions are compared
+static inline bool SamePositions(const TerrainVertex* a, const TerrainVertex* b, size_t count) {
+	for(size_t i=0; i<count; i++) {
+		if(a[i].x != b[i].x || a[i].y != b[i].y || a[i].height != b[i].height) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool TerrainKernelSupported(const TerrainRowKernel* k);
+// Fastest kernel supported by running cpu
+const TerrainRowKernel* TerrainBestKernel();
+
+#endif /* end of include guard: TERRAINKERNELS_H_DEFINED */
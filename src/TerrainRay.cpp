@@ -0,0 +1,182 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "TerrainRay.h"
+
+#include <math.h>
+#include <algorithm>
+
+#include "TerrainKernels.h"
+
+// Moller-Trumbore, distance along dir or negative if ray misses. Edges
+// are widened a bit so rays grazing shared edge hit either tile.
+static float RayTriangle(glm::vec3 o, glm::vec3 d, glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+	const float eps = 1e-5f;
+	glm::vec3 e1 = b-a, e2 = c-a;
+	glm::vec3 p = glm::cross(d, e2);
+	float det = glm::dot(e1, p);
+	if(fabsf(det) < 1e-8f) {
+		return -1.0f;
+	}
+	float inv = 1.0f/det;
+	glm::vec3 s = o-a;
+	float u = glm::dot(s, p)*inv;
+	if(u < -eps || u > 1.0f+eps) {
+		return -1.0f;
+	}
+	glm::vec3 q = glm::cross(s, e1);
+	float v = glm::dot(d, q)*inv;
+	if(v < -eps || u+v > 1.0f+eps) {
+		return -1.0f;
+	}
+	return glm::dot(e2, q)*inv;
+}
+
+float TerrainRayTile(const TerrainGrid<uint16_t> &heights, const TerrainGrid<uint32_t> &tiles, glm::vec3 origin, glm::vec3 dir, int x, int y) {
+	auto corner = [&](int px, int py) {
+		return glm::vec3(world_coord(px), heights(px, py)*TERRAIN_HEIGHT_SCALE, world_coord(py));
+	};
+	glm::vec3 corners[4] = {corner(x, y), corner(x+1, y), corner(x+1, y+1), corner(x, y+1)};
+	const uint8_t* index = TileOrientationOf(tiles(x, y)).index;
+	float best = -1.0f;
+	for(int i=0; i<6; i+=3) {
+		float t = RayTriangle(origin, dir, corners[index[i]], corners[index[i+1]], corners[index[i+2]]);
+		if(t >= 0.0f && (best < 0.0f || t < best)) {
+			best = t;
+		}
+	}
+	return best;
+}
+
+// Walks tiles under the ray from origin in order (Amanatides-Woo) and
+// stops at first one with a triangle hit. Whole pyramid nodes the ray
+// passes over are stepped across at once, the tile after a node is
+// found with integer math so float rounding far from origin can not
+// leave the walk in the same node.
+bool TerrainPickRay(const TerrainGrid<uint16_t> &heights, const TerrainGrid<uint32_t> &tiles, const HeightPyramid &pyramid, glm::vec3 origin, glm::vec3 dir, glm::ivec2* tile, glm::vec3* hit) {
+	const int w = heights.w, h = heights.h;
+	const float size = world_coord(1);
+	dir = glm::normalize(dir); // t is in world units
+	float tmin = 0.0f, tmax = INFINITY;
+	// clip to map rectangle
+	float lo[2] = {0.0f, 0.0f}, hi[2] = {world_coord(w-1)*1.0f, world_coord(h-1)*1.0f};
+	float o[2] = {origin.x, origin.z}, d[2] = {dir.x, dir.z};
+	bool moves[2] = {fabsf(d[0]) >= 1e-12f, fabsf(d[1]) >= 1e-12f};
+	for(int a=0; a<2; a++) {
+		if(!moves[a]) {
+			if(o[a] < lo[a] || o[a] > hi[a]) {
+				return false;
+			}
+			continue;
+		}
+		float t0 = (lo[a]-o[a])/d[a], t1 = (hi[a]-o[a])/d[a];
+		tmin = std::max(tmin, std::min(t0, t1));
+		tmax = std::min(tmax, std::max(t0, t1));
+	}
+	if(tmin > tmax) {
+		return false;
+	}
+	int cell[2], last[2] = {w-2, h-2};
+	float next[2];
+	// distance along ray to grid line cell is left through
+	auto exit = [&](int a) {
+		return moves[a] ? ((cell[a]+(d[a] > 0))*size-o[a])/d[a] : INFINITY;
+	};
+	// tile containing ray at tmin, on grid lines the one ray goes into,
+	// ray may start a hair outside of map after clipping
+	for(int a=0; a<2; a++) {
+		float p = (o[a]+d[a]*tmin)/size;
+		cell[a] = d[a] < 0 ? (int)ceilf(p)-1 : (int)floorf(p);
+		cell[a] = std::min(std::max(cell[a], 0), last[a]);
+		next[a] = exit(a);
+	}
+	int &x = cell[0], &y = cell[1];
+	int stepx = d[0] > 0 ? 1 : -1, stepy = d[1] > 0 ? 1 : -1;
+	// distance along ray between grid lines
+	float deltax = moves[0] ? size/fabsf(d[0]) : INFINITY;
+	float deltay = moves[1] ? size/fabsf(d[1]) : INFINITY;
+	float tcell = tmin; // where ray entered tile x, y
+	while(x >= 0 && y >= 0 && x <= last[0] && y <= last[1]) {
+		// Biggest pyramid node around tile that ray passes fully above or
+		// below of is skipped as a whole
+		bool skipped = false;
+		for(int l=pyramid.Levels()-1; l>0 && !skipped; l--) {
+			int node[2] = {x >> l, y >> l};
+			// first tile past node along each axis and distance to it
+			int past[2];
+			float texit[2];
+			for(int a=0; a<2; a++) {
+				past[a] = d[a] > 0 ? (node[a]+1) << l : (node[a] << l)-1;
+				int edge = std::min(d[a] > 0 ? past[a] : past[a]+1, last[a]+1);
+				texit[a] = moves[a] ? (world_coord(edge)-o[a])/d[a] : INFINITY;
+			}
+			float t = std::min(std::min(texit[0], texit[1]), tmax);
+			const HeightPyramid::Bounds &b = pyramid.Node(l, node[0], node[1]);
+			float enterh = origin.y+dir.y*tcell, exith = origin.y+dir.y*t;
+			float bottom = b.min*TERRAIN_HEIGHT_SCALE, top = b.max*TERRAIN_HEIGHT_SCALE;
+			if((enterh > top && exith > top) || (enterh < bottom && exith < bottom)) {
+				if(t >= tmax) {
+					return false;
+				}
+				// Axis (or both at a corner) ray leaves node through moves
+				// past it, other one is taken from position at exit and
+				// kept inside of node span
+				for(int a=0; a<2; a++) {
+					if(texit[a] <= t) {
+						cell[a] = past[a];
+					} else if(moves[a]) {
+						float p = (o[a]+d[a]*t)/size;
+						int c = d[a] < 0 ? (int)ceilf(p)-1 : (int)floorf(p);
+						c = std::min(std::max(c, node[a] << l), std::min(((node[a]+1) << l)-1, last[a]));
+						// ray only moves forward, rounding must not undo that
+						cell[a] = d[a] > 0 ? std::max(c, cell[a]) : std::min(c, cell[a]);
+					}
+					next[a] = exit(a);
+				}
+				tcell = t;
+				skipped = true;
+			}
+		}
+		if(skipped) {
+			continue;
+		}
+		float t = TerrainRayTile(heights, tiles, origin, dir, x, y);
+		if(t >= 0.0f) {
+			*tile = glm::ivec2(x, y);
+			if(hit) {
+				*hit = origin+dir*t;
+			}
+			return true;
+		}
+		if(std::min(next[0], next[1]) > tmax) {
+			break;
+		}
+		if(next[0] < next[1]) {
+			tcell = next[0];
+			x += stepx;
+			next[0] += deltax;
+		} else {
+			tcell = next[1];
+			y += stepy;
+			next[1] += deltay;
+		}
+	}
+	return false;
+}
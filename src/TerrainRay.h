@@ -0,0 +1,40 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef TERRAINRAY_H_DEFINED
+#define TERRAINRAY_H_DEFINED
+
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#include "TerrainGrid.h"
+#include "HeightPyramid.h"
+
+// Ray casts against terrain mesh in model space. Heights are raw map
+// point heights, tiles are packed (see TilePack) for their triflip and
+// pyramid is built over the same heights.
+
+// Both triangles of tile x, y as they are drawn, nearest hit distance
+// along dir or negative
+float TerrainRayTile(const TerrainGrid<uint16_t> &heights, const TerrainGrid<uint32_t> &tiles, glm::vec3 origin, glm::vec3 dir, int x, int y);
+// First tile hit by ray from origin, false if it leaves map
+bool TerrainPickRay(const TerrainGrid<uint16_t> &heights, const TerrainGrid<uint32_t> &tiles, const HeightPyramid &pyramid, glm::vec3 origin, glm::vec3 dir, glm::ivec2* tile, glm::vec3* hit);
+
+#endif /* end of include guard: TERRAINRAY_H_DEFINED */
@@ -0,0 +1,230 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "TextureCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "glad/glad.h"
+#include "log.hpp"
+#include "other.h"
+#include "ImageOps.h"
+
+#define TEXTURE_CACHE_MAGIC 0x43545a57 // "WZTC"
+#define TEXTURE_CACHE_VERSION 2
+
+struct TextureCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	int32_t w, h, layers, levels;
+	uint32_t format;
+};
+
+static uint64_t FNV1a(uint64_t hash, const void* data, size_t len) {
+	const unsigned char* p = (const unsigned char*)data;
+	for(size_t i=0; i<len; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+uint64_t TextureCacheKey(const char* name, int qual, bool compressed, const std::vector<const char*> &paths) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	int version = TEXTURE_CACHE_VERSION;
+	hash = FNV1a(hash, &version, sizeof(version));
+	hash = FNV1a(hash, name, strlen(name)+1);
+	hash = FNV1a(hash, &qual, sizeof(qual));
+	hash = FNV1a(hash, &compressed, sizeof(compressed));
+	for(auto p : paths) {
+		struct stat st;
+		int64_t meta[2] = {-1, -1};
+		if(stat(p, &st) == 0) {
+			meta[0] = st.st_size;
+			meta[1] = st.st_mtime;
+		}
+		hash = FNV1a(hash, p, strlen(p)+1);
+		hash = FNV1a(hash, meta, sizeof(meta));
+	}
+	return hash;
+}
+
+static char* TextureCachePath(uint64_t key) {
+	char* dir = secure_getenv("WZMAP_CACHE_PATH")?:(char*)"./cache/";
+	return sprcatr(NULL, "%s%016llx.wztc", dir, (unsigned long long)key);
+}
+
+size_t TextureLevelSize(unsigned int format, int w, int h, int layers, int level) {
+	size_t lw = std::max(1, w >> level), lh = std::max(1, h >> level);
+	switch(format) {
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		return (lw+3)/4*((lh+3)/4)*8*layers;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		return (lw+3)/4*((lh+3)/4)*16*layers;
+	}
+	return lw*lh*4*layers;
+}
+
+void TextureArrayUpload(unsigned int* tex, const unsigned char* const* pixels, int given, int w, int h, int layers, unsigned int format) {
+	int levels = ImageMipLevels(w, h);
+	if(*tex == 0) {
+		glGenTextures(1, tex);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, *tex);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for(int l=0; l<given && l<levels; l++) {
+		if(format == GL_RGBA8) {
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, l, GL_RGBA8, ImageMipSize(w, l), ImageMipSize(h, l), layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels[l]);
+		} else {
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, l, format, ImageMipSize(w, l), ImageMipSize(h, l), layers, 0,
+				TextureLevelSize(format, w, h, layers, l), pixels[l]);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels-1);
+	if(given < levels) {
+		if(format == GL_RGBA8) {
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		} else {
+			log_error("Compressed texture has %d of %d mip levels", given, levels);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, given-1);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	log_info("Texture array %dx%d, %d layers, %d mip levels, format 0x%x", w, h, layers, levels, format);
+}
+
+bool TextureCacheLoad(uint64_t key, CachedTextureArray* out) {
+	char* path = TextureCachePath(key);
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if(fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TextureCacheHeader)) {
+		close(fd);
+		return false;
+	}
+	void* m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(m == MAP_FAILED) {
+		log_warn("Failed to map texture cache: %s", strerror(errno));
+		return false;
+	}
+	const TextureCacheHeader* hdr = (const TextureCacheHeader*)m;
+	if(hdr->magic != TEXTURE_CACHE_MAGIC || hdr->version != TEXTURE_CACHE_VERSION || hdr->key != key ||
+		hdr->levels < 1 || hdr->levels > TEXTURE_CACHE_MAX_LEVELS) {
+		log_warn("Texture cache %016llx is stale or broken", (unsigned long long)key);
+		munmap(m, st.st_size);
+		return false;
+	}
+	size_t offset = sizeof(TextureCacheHeader);
+	for(int l=0; l<hdr->levels; l++) {
+		out->level[l] = (const unsigned char*)m + offset;
+		offset += TextureLevelSize(hdr->format, hdr->w, hdr->h, hdr->layers, l);
+	}
+	if(offset != (size_t)st.st_size) {
+		log_warn("Texture cache %016llx has wrong size", (unsigned long long)key);
+		munmap(m, st.st_size);
+		return false;
+	}
+	out->w = hdr->w;
+	out->h = hdr->h;
+	out->layers = hdr->layers;
+	out->levels = hdr->levels;
+	out->format = hdr->format;
+	out->mapping = m;
+	out->mappingsize = st.st_size;
+	return true;
+}
+
+void TextureCacheRelease(CachedTextureArray* c) {
+	if(c->mapping) {
+		munmap(c->mapping, c->mappingsize);
+	}
+	*c = CachedTextureArray();
+}
+
+void TextureArrayRead(unsigned int tex, TextureArrayData* out) {
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_WIDTH, &out->w);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_HEIGHT, &out->h);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_DEPTH, &out->layers);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_INTERNAL_FORMAT, (int*)&out->format);
+	glGetTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, &out->levels);
+	out->levels = std::min(out->levels+1, TEXTURE_CACHE_MAX_LEVELS);
+	out->level.resize(out->levels);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for(int l=0; l<out->levels; l++) {
+		out->level[l].resize(TextureLevelSize(out->format, out->w, out->h, out->layers, l));
+		if(out->format == GL_RGBA8) {
+			glGetTexImage(GL_TEXTURE_2D_ARRAY, l, GL_RGBA, GL_UNSIGNED_BYTE, out->level[l].data());
+		} else {
+			glGetCompressedTexImage(GL_TEXTURE_2D_ARRAY, l, out->level[l].data());
+		}
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+bool TextureCacheStore(uint64_t key, unsigned int tex) {
+	TextureArrayData data;
+	TextureArrayRead(tex, &data);
+	TextureCacheHeader hdr = {TEXTURE_CACHE_MAGIC, TEXTURE_CACHE_VERSION, key, data.w, data.h, data.layers, data.levels, data.format};
+	char* dir = secure_getenv("WZMAP_CACHE_PATH")?:(char*)"./cache/";
+	mkdir(dir, 0755);
+	char* path = TextureCachePath(key);
+	char* tmppath = sprcatr(NULL, "%s.tmp", path);
+	FILE* f = fopen(tmppath, "wb");
+	if(f == NULL) {
+		log_warn("Can not write texture cache [%s]: %s", tmppath, strerror(errno));
+		free(path);
+		free(tmppath);
+		return false;
+	}
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+	for(int l=0; l<hdr.levels && ok; l++) {
+		ok = fwrite(data.level[l].data(), data.level[l].size(), 1, f) == 1;
+	}
+	ok = fclose(f) == 0 && ok;
+	// readers never see half written file
+	if(ok && rename(tmppath, path) == 0) {
+		log_info("Texture cache written to [%s]", path);
+	} else {
+		log_warn("Failed to write texture cache [%s]", path);
+		unlink(tmppath);
+		ok = false;
+	}
+	free(path);
+	free(tmppath);
+	return ok;
+}
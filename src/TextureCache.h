@@ -0,0 +1,63 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef TEXTURECACHE_H_DEFINED
+#define TEXTURECACHE_H_DEFINED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define TEXTURE_CACHE_MAX_LEVELS 16
+
+// Baked texture array with its whole mip chain, stored in
+// $WZMAP_CACHE_PATH (./cache/ by default) and mapped back on load.
+// Format is GL_RGBA8 or one of S3TC DXT1/DXT5 compressed formats.
+struct CachedTextureArray {
+	int w = 0, h = 0, layers = 0, levels = 0;
+	unsigned int format = 0;
+	const unsigned char* level[TEXTURE_CACHE_MAX_LEVELS] = {0};
+	void* mapping = nullptr;
+	size_t mappingsize = 0;
+};
+
+// Hash of name, quality, compression and size and modification time of
+// every file, changing any source file gives a different key
+uint64_t TextureCacheKey(const char* name, int qual, bool compressed, const std::vector<const char*> &paths);
+// Bytes in one mip level of all layers
+size_t TextureLevelSize(unsigned int format, int w, int h, int layers, int level);
+// Creates or replaces GL_TEXTURE_2D_ARRAY *tex from given levels of
+// pixels, missing levels of uncompressed formats are generated
+void TextureArrayUpload(unsigned int* tex, const unsigned char* const* pixels, int given, int w, int h, int layers, unsigned int format);
+// Maps cache file of key, false if there is none or it is broken
+bool TextureCacheLoad(uint64_t key, CachedTextureArray* out);
+void TextureCacheRelease(CachedTextureArray* c);
+// Whole mip chain of a texture array in client memory, every level
+// holds all layers one after another
+struct TextureArrayData {
+	int w = 0, h = 0, layers = 0, levels = 0;
+	unsigned int format = 0;
+	std::vector<std::vector<unsigned char>> level;
+};
+void TextureArrayRead(unsigned int tex, TextureArrayData* out);
+// Reads all levels of GL_TEXTURE_2D_ARRAY tex back and writes them
+bool TextureCacheStore(uint64_t key, unsigned int tex);
+
+#endif /* end of include guard: TEXTURECACHE_H_DEFINED */
@@ -0,0 +1,126 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <atomic>
+#include <memory>
+
+#include "ThreadPool.h"
+
+#include "log.hpp"
+#include "args.h"
+
+ThreadPool::ThreadPool(int threads) {
+	if(threads <= 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for(int i=0; i<threads; i++) {
+		workers.emplace_back(&ThreadPool::Work, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> l(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for(auto &t : workers) {
+		t.join();
+	}
+}
+
+int ThreadPool::Size() {
+	return workers.size();
+}
+
+void ThreadPool::Work() {
+	while(true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> l(lock);
+			wake.wait(l, [this] { return stopping || !tasks.empty() || !urgent.empty(); });
+			std::deque<std::function<void()>> &q = urgent.empty() ? tasks : urgent;
+			if(q.empty()) {
+				return;
+			}
+			task = std::move(q.front());
+			q.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+	{
+		std::lock_guard<std::mutex> l(lock);
+		tasks.push_back(std::move(task));
+	}
+	wake.notify_one();
+}
+
+void ThreadPool::ParallelFor(int count, std::function<void(int, int)> fn) {
+	int bands = std::min(count, Size());
+	if(bands <= 1) {
+		if(count > 0) {
+			fn(0, count);
+		}
+		return;
+	}
+	// Bands are claimed through a counter by caller and by helpers,
+	// helpers that start late find nothing left, state outlives caller
+	struct Bands {
+		std::function<void(int, int)> fn;
+		int count, bands;
+		std::atomic<int> next{0};
+		std::mutex donelock;
+		std::condition_variable donecv;
+		int remaining;
+		void Run() {
+			int i;
+			while((i = next++) < bands) {
+				fn((long)count*i/bands, (long)count*(i+1)/bands);
+				std::lock_guard<std::mutex> l(donelock);
+				if(--remaining == 0) {
+					donecv.notify_one();
+				}
+			}
+		}
+	};
+	auto state = std::make_shared<Bands>();
+	state->fn = std::move(fn);
+	state->count = count;
+	state->bands = bands;
+	state->remaining = bands;
+	{
+		std::lock_guard<std::mutex> l(lock);
+		for(int i=0; i<bands-1; i++) {
+			urgent.push_back([state] { state->Run(); });
+		}
+	}
+	wake.notify_all();
+	state->Run();
+	std::unique_lock<std::mutex> l(state->donelock);
+	state->donecv.wait(l, [&] { return state->remaining == 0; });
+}
+
+ThreadPool& WorkerPool() {
+	static ThreadPool pool(ArgSingleThread ? 1 : 0);
+	return pool;
+}
@@ -0,0 +1,58 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef THREADPOOL_H_DEFINED
+#define THREADPOOL_H_DEFINED
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool {
+public:
+	// 0 threads means one per hardware thread
+	ThreadPool(int threads);
+	~ThreadPool();
+	int Size();
+	// Queues background task to be run on one of workers
+	void Submit(std::function<void()> task);
+	// Splits [0, count) into continuous bands and calls fn(begin, end)
+	// for each of them in parallel, returns when all bands are done.
+	// Bands go ahead of queued background tasks and calling thread
+	// runs them too, so it never waits for unrelated work.
+	// Must not be called from inside of pool tasks.
+	void ParallelFor(int count, std::function<void(int, int)> fn);
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::deque<std::function<void()>> urgent; // ParallelFor helpers
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping = false;
+	void Work();
+};
+
+// Shared pool, single threaded if --single-thread was given
+ThreadPool& WorkerPool();
+
+#endif /* end of include guard: THREADPOOL_H_DEFINED */
@@ -0,0 +1,177 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "TileResidency.h"
+
+#include <algorithm>
+
+#include "glad/glad.h"
+#include "log.hpp"
+#include "ImageOps.h"
+
+bool TileResidency::Build(unsigned int tiles, uint64_t cachekey, size_t budget, int demote) {
+	TextureCacheRelease(&Source);
+	if(!TextureCacheLoad(cachekey, &Source) && !(TextureCacheStore(cachekey, tiles) && TextureCacheLoad(cachekey, &Source))) {
+		log_error("Tile array has no texture cache, residency is not used");
+		return false;
+	}
+	if(Source.layers == 0) {
+		log_error("Tile array is empty, residency is not used");
+		TextureCacheRelease(&Source);
+		return false;
+	}
+	FullBytes = 0;
+	for(int l=0; l<Source.levels; l++) {
+		FullBytes += TextureLevelSize(Source.format, Source.w, Source.h, Source.layers, l);
+	}
+	Configure(tiles, budget, demote);
+	return true;
+}
+
+void TileResidency::Configure(unsigned int tiles, size_t budget, int demote) {
+	demote = std::max(0, std::min(demote, Source.levels-1));
+	int bw = ImageMipSize(Source.w, demote), bh = ImageMipSize(Source.h, demote);
+	std::vector<const unsigned char*> base;
+	BaseBytes = 0;
+	for(int l=demote; l<Source.levels; l++) {
+		base.push_back(Source.level[l]);
+		BaseBytes += TextureLevelSize(Source.format, Source.w, Source.h, Source.layers, l);
+	}
+	TextureArrayUpload(&tiles, base.data(), base.size(), bw, bh, Source.layers, Source.format);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tiles);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	size_t slotbytes = FullBytes/Source.layers;
+	Slots = budget > BaseBytes ? std::min<size_t>((budget-BaseBytes)/slotbytes, Source.layers) : 0;
+	HotBytes = slotbytes*Slots;
+	// one layer is kept even without slots so sampler stays complete
+	std::vector<const unsigned char*> empty(Source.levels, nullptr);
+	TextureArrayUpload(&HotArray, empty.data(), Source.levels, Source.w, Source.h, std::max(Slots, 1), Source.format);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, HotArray);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	SlotOfLayer.assign(Source.layers, -1);
+	LayerOfSlot.assign(Slots, -1);
+	SlotsUsed = 0;
+	UploadSlotsTable();
+	log_info("Tile residency: base %dx%d %ld KiB, %d full quality slots %ld KiB, all full quality %ld KiB",
+		bw, bh, BaseBytes/1024, Slots, HotBytes/1024, FullBytes/1024);
+}
+
+void TileResidency::Release() {
+	if(HotArray) {
+		glDeleteTextures(1, &HotArray);
+		HotArray = 0;
+	}
+	if(SlotsTex) {
+		glDeleteTextures(1, &SlotsTex);
+		SlotsTex = 0;
+	}
+	TextureCacheRelease(&Source);
+	SlotOfLayer.clear();
+	LayerOfSlot.clear();
+	Slots = SlotsUsed = 0;
+	BaseBytes = HotBytes = FullBytes = 0;
+}
+
+void TileResidency::Update(const std::vector<float> &distance) {
+	if(HotArray == 0) {
+		return;
+	}
+	std::vector<int> wanted;
+	for(size_t i=0; i<distance.size() && i<SlotOfLayer.size(); i++) {
+		if(distance[i] >= 0) {
+			wanted.push_back(i);
+		}
+	}
+	std::sort(wanted.begin(), wanted.end(), [&](int a, int b) { return distance[a] < distance[b]; });
+	if((int)wanted.size() > Slots) {
+		wanted.resize(Slots);
+	}
+	std::vector<bool> keep(Source.layers, false);
+	for(int l : wanted) {
+		keep[l] = true;
+	}
+	// slots of layers that are no longer nearest are freed first, then
+	// nearest layers without slot take them
+	bool changed = false;
+	for(int s=0; s<Slots; s++) {
+		int l = LayerOfSlot[s];
+		if(l >= 0 && !keep[l]) {
+			SlotOfLayer[l] = -1;
+			LayerOfSlot[s] = -1;
+			SlotsUsed--;
+			changed = true;
+		}
+	}
+	int uploads = 0, freeslot = 0;
+	for(int l : wanted) {
+		if(SlotOfLayer[l] >= 0) {
+			continue;
+		}
+		if(uploads >= MaxUploads) {
+			break;
+		}
+		while(LayerOfSlot[freeslot] >= 0) {
+			freeslot++;
+		}
+		UploadSlot(freeslot, l);
+		SlotOfLayer[l] = freeslot;
+		LayerOfSlot[freeslot] = l;
+		SlotsUsed++;
+		uploads++;
+		changed = true;
+	}
+	if(changed) {
+		UploadSlotsTable();
+	}
+}
+
+void TileResidency::UploadSlot(int slot, int layer) {
+	glBindTexture(GL_TEXTURE_2D_ARRAY, HotArray);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for(int l=0; l<Source.levels; l++) {
+		int lw = ImageMipSize(Source.w, l), lh = ImageMipSize(Source.h, l);
+		size_t size = TextureLevelSize(Source.format, Source.w, Source.h, 1, l);
+		const unsigned char* src = Source.level[l] + size*layer;
+		if(Source.format == GL_RGBA8) {
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, slot, lw, lh, 1, GL_RGBA, GL_UNSIGNED_BYTE, src);
+		} else {
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, slot, lw, lh, 1, Source.format, size, src);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void TileResidency::UploadSlotsTable() {
+	if(SlotsTex == 0) {
+		glGenTextures(1, &SlotsTex);
+	}
+	std::vector<int16_t> table(SlotOfLayer.begin(), SlotOfLayer.end());
+	glBindTexture(GL_TEXTURE_2D, SlotsTex);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16I, table.size(), 1, 0, GL_RED_INTEGER, GL_SHORT, table.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
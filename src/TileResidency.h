@@ -0,0 +1,57 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef TILERESIDENCY_H_DEFINED
+#define TILERESIDENCY_H_DEFINED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "TextureCache.h"
+
+// Keeps full quality tile layers only for tiles near the camera. Tile
+// array itself is shrunk to a few mip levels below full quality and
+// nearest tiles get a slot in HotArray as long as budget allows.
+// Shaders look tile layer up in SlotsTex, -1 means no slot. Slots are
+// filled from texture cache file of the array mapped read only, no copy
+// of the array is kept in memory.
+class TileResidency {
+public:
+	unsigned int HotArray = 0, SlotsTex = 0;
+	int Slots = 0, SlotsUsed = 0;
+	size_t BaseBytes = 0, HotBytes = 0, FullBytes = 0;
+	int MaxUploads = 8; // slot uploads per Update
+	// Maps cache file of full quality array (stored first if missing)
+	// and shrinks tiles by demote levels
+	bool Build(unsigned int tiles, uint64_t cachekey, size_t budget, int demote);
+	// Changes budget and demotion, tiles has to be the same array
+	void Configure(unsigned int tiles, size_t budget, int demote);
+	void Release();
+	// Distance of every layer to camera, negative if it is not in view
+	void Update(const std::vector<float> &distance);
+private:
+	CachedTextureArray Source;
+	std::vector<int> SlotOfLayer, LayerOfSlot;
+	void UploadSlot(int slot, int layer);
+	void UploadSlotsTable();
+};
+
+#endif /* end of include guard: TILERESIDENCY_H_DEFINED */
@@ -21,6 +21,7 @@
 #include "World3d.h"
 
 #include "log.hpp"
+#include "args.h"
 
 #include <stdio.h>
 #include "glad/glad.h"
@@ -30,6 +31,8 @@
 #include <glm/gtx/string_cast.hpp>
 #include <unistd.h>
 
+static const ShaderHandle UObjectId = ShaderUniform("ObjectId");
+
 // // Search in textures, maybe we already loaded it...
 // Texture* World3d::GetTexture(std::string filepath) {
 // 	for(long unsigned int i=0; i<Textures.size(); i++) {
@@ -63,10 +66,20 @@
 // 	return texids++;
 // }
 
-void World3d::RenderScene(glm::mat4 view) {
-	Ter.RenderV(view);
+void World3d::RenderScene(glm::mat4 view, glm::vec3 camera) {
+	Ter.RenderV(view, camera);
+	ObjectsShader->use();
 	for(auto &a : Objects) {
-		a->Render(ObjectsShader->program);
+		a->Render(ObjectsShader);
+	}
+}
+
+void World3d::RenderPick() {
+	Ter.RenderPick();
+	ObjectPickShader->use();
+	for(size_t i = 0; i < Objects.size(); i++) {
+		ObjectPickShader->Set(UObjectId, PICK_OBJECT_BIT | (unsigned int)(i+1));
+		Objects[i]->Render(ObjectPickShader);
 	}
 }
 
@@ -79,19 +92,28 @@ World3d::World3d(WZmap* m, SDL_Renderer *r) {
 		abort();
 	}
 	this->map = m;
+	Ter.GPUExpand = ArgGPUTerrain;
 	Ter.GetHeightmapFromMWT(this->map);
 	char* datapath = secure_getenv("WZMAP_DATA_PATH")?:(char*)"./data/";
-	Ter.CreateTexturePage(datapath, 128, Renderer);
+	Ter.CreateTexturePage(datapath, 128);
 	Ter.LoadTerrainGrounds(datapath);
 	Ter.LoadTerrainGroundTypes(datapath);
+	Ter.ConstructGroundAlphas();
 	Ter.UpdateTexpageCoords();
+	if(ArgBenchTerrain && !Ter.GPUExpand) {
+		Ter.BenchmarkKernels();
+	}
+	if(ArgBenchTerrain) {
+		Ter.BenchmarkMipmaps();
+		Ter.BenchmarkPicking();
+	}
 	Ter.CreateShader();
 	Ter.BufferData();
 	ObjectsShader = new Shader("./data/vertex.vs", "./data/fragment.frag");
+	ObjectPickShader = new Shader("./data/vertex.vs", "./data/ObjectPickFragment.frag");
 }
 
 World3d::~World3d() {
-	Ter.~Terrain();
 	for(auto a : this->Textures) {
 		a->~Texture();
 		delete a;
@@ -99,4 +121,7 @@ World3d::~World3d() {
 	if(ObjectsShader) {
 		delete ObjectsShader;
 	}
+	if(ObjectPickShader) {
+		delete ObjectPickShader;
+	}
 }
@@ -34,6 +34,7 @@
 #include "Object3d.h"
 #include "Texture.h"
 #include "terrain.h"
+#include "PickBuffer.h"
 
 class World3d {
 private:
@@ -41,6 +42,7 @@ private:
 	// int GetNextTextureId();
 	// Texture* GetTexture(std::string filepath);
 	Shader* ObjectsShader = nullptr;
+	Shader* ObjectPickShader = nullptr;
 public:
 	WZmap* map;
 	std::vector<Object3d*> Objects;
@@ -50,7 +52,9 @@ public:
 	World3d(WZmap *m, SDL_Renderer *r);
 	~World3d();
 	// void AddObject(std::string filename, unsigned int);
-	void RenderScene(glm::mat4 view);
+	void RenderScene(glm::mat4 view, glm::vec3 camera);
+	// Draws PickBuffer ids of terrain and Objects, call after RenderScene
+	void RenderPick();
 };
 
 #endif /* end of include guard: WORLD3D_H_INCLUDED */
@@ -27,6 +27,10 @@
 #include "other.h"
 
 char* ArgTexpagesPath = NULL;
+bool ArgBenchTerrain = false;
+bool ArgSingleThread = false;
+bool ArgGPUTerrain = false;
+bool ArgCompressTextures = false;
 
 void ProcessArgs(int argc, char** argv) {
 	for(int i=1; i<argc; i++) {
@@ -53,6 +57,14 @@ void ProcessArgs(int argc, char** argv) {
 			} else {
 				log_fatal("-t expects argument.");
 			}
+		} else if(equalstr(argv[i], "--bench-terrain")) {
+			ArgBenchTerrain = true;
+		} else if(equalstr(argv[i], "--single-thread")) {
+			ArgSingleThread = true;
+		} else if(equalstr(argv[i], "--gpu-terrain")) {
+			ArgGPUTerrain = true;
+		} else if(equalstr(argv[i], "--compress-textures")) {
+			ArgCompressTextures = true;
 		} else if(equalstr(argv[i], "--help") || equalstr(argv[i], "-h")) {
 			printf("   Warzone 2100 Map Editor\n");
 			printf("   \n");
@@ -64,6 +76,10 @@ void ProcessArgs(int argc, char** argv) {
 			printf("   -q   (--quiet)       Do not log to stdout.\n");
 			printf("   -log (--loglevel)    Set logging level.\n");
 			printf("   -t <path>            Set Path to texpages directory contents.\n");
+			printf("   --bench-terrain      Check and time terrain mesh kernels on load.\n");
+			printf("   --single-thread      Do all loading work on one thread (for debugging).\n");
+			printf("   --gpu-terrain        Expand terrain tiles on GPU from height and tile textures.\n");
+			printf("   --compress-textures  Compress terrain textures to BC1/BC3 (S3TC) on load.\n");
 			printf("   \n");
 			exit(0);
 		}
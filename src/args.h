@@ -22,6 +22,10 @@
 #define ARGS_H_DEFINED
 
 extern char* ArgTexpagesPath;
+extern bool ArgBenchTerrain;
+extern bool ArgSingleThread;
+extern bool ArgGPUTerrain;
+extern bool ArgCompressTextures;
 
 void ProcessArgs(int argc, char** argv);
 
@@ -37,6 +37,7 @@
 #include "Shader.h"
 #include "pie.h"
 #include "World3d.h"
+#include "PerFrame.h"
 #include "terrain.h"
 #include "args.h"
 #include "other.h"
@@ -141,8 +142,10 @@ int main(int argc, char** argv) {
 	glGenBuffers(1, &TileSelectionVertexBufferObject);
 	glBindBuffer(GL_ARRAY_BUFFER, TileSelectionVertexBufferObject);
 	glBufferData(GL_ARRAY_BUFFER, TileSelectionVertexArray.size() * 3 * sizeof(float), &TileSelectionVertexArray[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(glGetAttribLocation(TileSelectionShader.program, "VertexCoordinates"), 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(glGetAttribLocation(TileSelectionShader.program, "VertexCoordinates"));
+	int selectionloc = TileSelectionShader.Attribute("VertexCoordinates");
+	glVertexAttribPointer(selectionloc, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(selectionloc);
+	PerFrame Frame;
 
 	glm::ivec2 mousePosition(0, 0);
 	glm::vec3 cameraPosition(-249.569931, 2752.000000, 1513.794312);
@@ -154,65 +157,27 @@ int main(int argc, char** argv) {
 	float cameraFOV = 75.0f;
 	glEnablei(GL_BLEND, 0);
 
-	glm::ivec3 tileScreenCoords[256][256];
-	long visibleTilesUpdateTime = 0;
-	auto visibleTilesUpdate = [&] () {
-		for(int y = 0; y < World.Ter.h; y++) {
-			for(int x = 0; x < World.Ter.w; x++) {
-				auto projectedPosition = glm::vec4(viewProjection * glm::vec4(world_coord(x), world_coord(World.Ter.tiles[x][y].height), world_coord(y), 1.f));
-				const float xx = projectedPosition.x / projectedPosition.w;
-				const float yy = projectedPosition.y / projectedPosition.w;
-				int screenX = (.5 + (.5 * xx)) * width;
-				int screenY = (.5 - (.5 * yy)) * height;
-
-				// This prevents tiles "behind the camera" from interfering
-				// Once projectedPosition.w hits 0 or under, the view "inverts" and goes back into regular XY screen coordinates
-				int screenZ = projectedPosition.w;
-				if (projectedPosition.w <= 0) {
-					screenZ = -1;
-				}
-
-				tileScreenCoords[x][y] = glm::ivec3(screenX, screenY, screenZ);
-			}
-		}
-	};
-
 	glm::ivec2 mouseTilePosition(0, 0);
-	bool mouseTilePositionDirty = false;
 	auto mouseTilePositionUpdate = [&] () {
-		for(int y = 0; y < World.Ter.h - 1; y++) {
-			for(int x = 0; x < World.Ter.w - 1; x++) {
-				auto aa = tileScreenCoords[x][y];
-				auto ba = tileScreenCoords[x + 1][y];
-				auto ab = tileScreenCoords[x][y + 1];
-				auto bb = tileScreenCoords[x + 1][y + 1];
-
-				int minX = std::min((int)aa.x, std::min((int)ba.x, std::min((int)ab.x, (int)bb.x)));
-				int maxX = std::max((int)aa.x, std::max((int)ba.x, std::max((int)ab.x, (int)bb.x)));
-				int minY = std::min((int)aa.y, std::min((int)ba.y, std::min((int)ab.y, (int)bb.y)));
-				int maxY = std::max((int)aa.y, std::max((int)ba.y, std::max((int)ab.y, (int)bb.y)));
-
-				// If any point is behind the camera, the tile is not valid for this check
-				int minW = std::min(aa.z, std::min(ba.z, std::min(ab.z, bb.z)));
-				if(minW < 0) {
-					continue;
-				}
-
-				if(mousePosition.x < minX) {
-					continue;
-				}
-				if(mousePosition.x > maxX) {
-					continue;
-				}
-				if(mousePosition.y < minY) {
-					continue;
-				}
-				if(mousePosition.y > maxY) {
-					continue;
-				}
+		glm::vec2 ndc(2.0f*mousePosition.x/width - 1.0f, 1.0f - 2.0f*mousePosition.y/height);
+		World.Ter.PickScreen(viewProjection, ndc, &mouseTilePosition);
+	};
 
-				mouseTilePosition = { x, y };
-			}
+	// GPU picking: pixel exact ids of terrain and objects, lagging a
+	// frame or two behind cursor because of asynchronous readback
+	bool GPUPicking = false;
+	PickBuffer Picker;
+	int mouseObject = -1;
+	auto mousePickUpdate = [&] () {
+		unsigned int id;
+		if(!Picker.Poll(&id)) {
+			return;
+		}
+		mouseObject = -1;
+		if(id & PICK_OBJECT_BIT) {
+			mouseObject = (id & ~PICK_OBJECT_BIT) - 1;
+		} else if(id != PICK_NONE) {
+			mouseTilePosition = glm::ivec2((id-1) % World.Ter.w, (id-1) / World.Ter.w);
 		}
 	};
 
@@ -249,7 +214,6 @@ int main(int argc, char** argv) {
 				if(!io.WantCaptureMouse) {
 					mousePosition.x = ev.motion.x;
 					mousePosition.y = ev.motion.y;
-					mouseTilePositionDirty = true;
 
 					if(cursorTrapped) {
 						cameraRotation.x -= ev.motion.yrel/2.0f;
@@ -350,7 +314,6 @@ int main(int argc, char** argv) {
 		}
 
 		if(cameraVelocity.x != 0 || cameraVelocity.y != 0 || cameraVelocity.z != 0){
-			mouseTilePositionDirty = true;
 			cameraPosition.x += glm::sin(glm::radians(cameraRotation.y))*cameraSpeed*cameraVelocity.z;
 			// cameraPosition.y -= glm::sin(glm::radians(cameraRotation.x))*cameraSpeed*cameraVelocity.z;
 			cameraPosition.z += glm::cos(glm::radians(cameraRotation.y))*cameraSpeed*cameraVelocity.z;
@@ -359,15 +322,17 @@ int main(int argc, char** argv) {
 			cameraPosition.z -= glm::sin(glm::radians(cameraRotation.y))*cameraSpeed*cameraVelocity.x;
 		}
 		cameraUpdate();
-
-		if(mouseTilePositionDirty){
+		Frame.Data.ViewProjection = viewProjection;
+		Frame.Data.CameraPosition = glm::vec4(cameraPosition, 1.0f);
+		Frame.Data.Viewport = glm::vec4(0.0f, 0.0f, width, height);
+		Frame.Data.Time = SDL_GetTicks()/1000.0f;
+		Frame.Update();
+
+		// picking is cheap enough to follow camera and edits every frame
+		if(GPUPicking) {
+			mousePickUpdate();
+		} else {
 			mouseTilePositionUpdate();
-			mouseTilePositionDirty = false;
-		}
-
-		if(visibleTilesUpdateTime < SDL_GetTicks()){
-			visibleTilesUpdate();
-			visibleTilesUpdateTime = SDL_GetTicks() + 1000;
 		}
 
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -412,9 +377,50 @@ int main(int argc, char** argv) {
 													ImGuiWindowFlags_NoBackground);
 			ImGui::Checkbox("Fps limit", &FPSlimiter);
 			ImGui::Checkbox("Fill textures", &World.Ter.FillTextures);
+			if(!World.Ter.GPUExpand) {
+				ImGui::Checkbox("Terrain LOD", &World.Ter.LODEnabled);
+			}
+			if(World.Ter.LODEnabled && !World.Ter.GPUExpand) {
+				ImGui::SliderFloat("LOD distance", &World.Ter.LODDistance, 512.0f, 16384.0f);
+			}
+			ImGui::SliderFloat("Ground blend", &World.Ter.GroundMix, 0.0f, 1.0f);
+			if(ImGui::Checkbox("GPU picking", &GPUPicking)) {
+				mouseObject = -1;
+			}
+			if(GPUPicking) {
+				ImGui::Text("Hovered object: %d", mouseObject);
+			}
+			static const int qualities[] = {16, 32, 64, 128};
+			int quality = World.Ter.TileQuality;
+			if(ImGui::BeginCombo("Tile quality", std::to_string(quality).c_str())) {
+				for(int q : qualities) {
+					if(ImGui::Selectable(std::to_string(q).c_str(), q == quality)) {
+						World.Ter.SetTileQuality(q);
+					}
+				}
+				ImGui::EndCombo();
+			}
+			bool residency = World.Ter.ResidencyEnabled;
+			if(ImGui::Checkbox("Tile residency", &residency)) {
+				World.Ter.SetResidency(residency);
+			}
+			if(World.Ter.ResidencyEnabled) {
+				ImGui::SliderFloat("VRAM budget MiB", &World.Ter.ResidencyBudgetMiB, 0.5f, 64.0f);
+				if(ImGui::IsItemDeactivatedAfterEdit()) {
+					World.Ter.ConfigureResidency();
+				}
+				ImGui::SliderInt("Demote levels", &World.Ter.ResidencyDemote, 0, 4);
+				if(ImGui::IsItemDeactivatedAfterEdit()) {
+					World.Ter.ConfigureResidency();
+				}
+				ImGui::SliderFloat("Full quality distance", &World.Ter.ResidencyDistance, 256.0f, 16384.0f);
+				TileResidency &r = World.Ter.Residency;
+				ImGui::Text("Tiles: %ld KiB of %ld KiB, slots %d/%d", (r.BaseBytes+r.HotBytes)/1024, r.FullBytes/1024, r.SlotsUsed, r.Slots);
+			}
 			ImGui::Text("%.3f (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 			ImGui::Text("Cam map pos: %3d %3d", cameraMapPosition.x, cameraMapPosition.y);
 			ImGui::Text("Cam fov: %f", cameraFOV);
+			ImGui::Text("Terrain chunks: %d/%ld Triangles: %ld", World.Ter.ChunksVisible, World.Ter.chunks.size(), World.Ter.TrianglesVisible);
 			ImGui::Text("Dataset: %s", TilesetStrings[map->tileset]);
 			if(ImGui::Button("Print camera pos")) {
 	            log_info("Camera:\n\
@@ -449,11 +455,29 @@ int main(int argc, char** argv) {
 		if(ShowTileDebugger) {
 			ImGui::Begin("Tile debugger", &ShowTileDebugger);
 			ImGui::Text("Tile x%d y%d", mouseTilePosition[0], mouseTilePosition[1]);
-			struct Terrain::tileinfo t = World.Ter.tiles[mouseTilePosition[0]][mouseTilePosition[1]];
-			ImGui::Text("Flip: %c:%c Rot: %d", t.fx?'X':'_', t.fy?'Y':'_', t.rot);
-			ImGui::Text("Texture: %3d Flip: %c", t.texture, t.triflip?'Y':'N');
-			ImGui::Text("Height: %f", t.height);
-			ImGui::Text("TT: %s", WMT_TerrainTypesStrings[(int)t.tt]);
+			int tx = mouseTilePosition[0], ty = mouseTilePosition[1];
+			uint32_t t = World.Ter.tilebits(tx, ty);
+			ImGui::Text("Flip: %c:%c Rot: %d", TileXFlip(t)?'X':'_', TileYFlip(t)?'Y':'_', TileRotation(t));
+			ImGui::Text("Texture: %3d Flip: %c", TileTexture(t), TileTriFlip(t)?'Y':'N');
+			ImGui::Text("Height: %d", World.Ter.heights(tx, ty));
+			ImGui::Text("TT: %s", WMT_TerrainTypesStrings[(int)TileTerrainType(t)]);
+			ImGui::Separator();
+			int nheight = World.Ter.heights(tx, ty);
+			if(ImGui::SliderInt("Height", &nheight, 0, 510)) {
+				World.Ter.SetHeight(tx, ty, nheight);
+			}
+			int ntexture = TileTexture(t), nrot = TileRotation(t);
+			bool nfx = TileXFlip(t), nfy = TileYFlip(t), ntriflip = TileTriFlip(t);
+			bool changed = ImGui::InputInt("Texture", &ntexture);
+			changed |= ImGui::SliderInt("Rotation", &nrot, 0, 3);
+			changed |= ImGui::Checkbox("Flip X", &nfx);
+			ImGui::SameLine();
+			changed |= ImGui::Checkbox("Flip Y", &nfy);
+			ImGui::SameLine();
+			changed |= ImGui::Checkbox("Triflip", &ntriflip);
+			if(changed && ntexture >= 0 && ntexture < World.Ter.DatasetLoaded) {
+				World.Ter.SetTile(tx, ty, ntexture, nrot, nfx, nfy, ntriflip);
+			}
 			ImGui::End();
 		}
 		if(ShowStructureEditor) {
@@ -488,14 +512,18 @@ int main(int argc, char** argv) {
 			ImGui::End();
 		}
 
-		World.RenderScene(viewProjection);
+		World.RenderScene(viewProjection, cameraPosition);
+		if(GPUPicking && Picker.Begin(width, height, mousePosition.x, mousePosition.y)) {
+			World.RenderPick();
+			Picker.End();
+		}
 
 		if(mouseTilePosition.x != -1){
 			glm::ivec2 mouseTileWorldCoordinates = { world_coord(mouseTilePosition.x), world_coord(mouseTilePosition.y) };
-			auto aa = 32+world_coord(World.Ter.tiles[mouseTilePosition.x][mouseTilePosition.y].height);
-			auto ab = 32+world_coord(World.Ter.tiles[mouseTilePosition.x + 1][mouseTilePosition.y].height);
-			auto ba = 32+world_coord(World.Ter.tiles[mouseTilePosition.x][mouseTilePosition.y + 1].height);
-			auto bb = 32+world_coord(World.Ter.tiles[mouseTilePosition.x + 1][mouseTilePosition.y + 1].height);
+			auto aa = 32+World.Ter.WorldHeight(mouseTilePosition.x, mouseTilePosition.y);
+			auto ab = 32+World.Ter.WorldHeight(mouseTilePosition.x + 1, mouseTilePosition.y);
+			auto ba = 32+World.Ter.WorldHeight(mouseTilePosition.x, mouseTilePosition.y + 1);
+			auto bb = 32+World.Ter.WorldHeight(mouseTilePosition.x + 1, mouseTilePosition.y + 1);
 
 			TileSelectionVertexArray[0] = { mouseTileWorldCoordinates.x + 0.0f, aa, mouseTileWorldCoordinates.y + 0.0f };
 			TileSelectionVertexArray[1] = { mouseTileWorldCoordinates.x + 0.0f, ba, mouseTileWorldCoordinates.y + 128.0f };
@@ -508,7 +536,6 @@ int main(int argc, char** argv) {
 			glBufferData(GL_ARRAY_BUFFER, TileSelectionVertexArray.size() * 3 * sizeof(float), &TileSelectionVertexArray[0], GL_STATIC_DRAW);
 
 			TileSelectionShader.use();
-			glUniformMatrix4fv(glGetUniformLocation(TileSelectionShader.program, "ViewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
 			glBindVertexArray(TileSelectionVertexArrayObject);
 			glDisable(GL_DEPTH_TEST);
 			glDrawArrays(GL_TRIANGLES, 0, 6);
@@ -525,6 +552,9 @@ int main(int argc, char** argv) {
 		}
 	}
 
+	Picker.Free();
+	Frame.Free();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
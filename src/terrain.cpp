@@ -21,15 +21,74 @@
 #include "terrain.h"
 
 #include <dirent.h>
-#include <SDL2/SDL_image.h>
 #include <errno.h>
+#include <string.h>
+#include <chrono>
+#include <atomic>
 
 #include "other.h"
+#include "ThreadPool.h"
+#include "TextureCache.h"
+#include "BlockCompress.h"
+#include "ImageOps.h"
+#include "TerrainRay.h"
+#include "args.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+static const ShaderHandle UModel = ShaderUniform("Model");
+static const ShaderHandle UTexture = ShaderUniform("Texture");
+static const ShaderHandle UTileResidency = ShaderUniform("TileResidency");
+static const ShaderHandle UTileHot = ShaderUniform("TileHot");
+static const ShaderHandle UTileSlots = ShaderUniform("TileSlots");
+static const ShaderHandle UGrounds = ShaderUniform("Grounds");
+static const ShaderHandle UGroundWeights = ShaderUniform("GroundWeights");
+static const ShaderHandle UGroundCount = ShaderUniform("GroundCount");
+static const ShaderHandle UGroundLayers = ShaderUniform("GroundLayers");
+static const ShaderHandle UGroundScales = ShaderUniform("GroundScales");
+static const ShaderHandle UGroundPlaceholders = ShaderUniform("GroundPlaceholders");
+static const ShaderHandle UMapSize = ShaderUniform("MapSize");
+static const ShaderHandle UGroundMix = ShaderUniform("GroundMix");
+static const ShaderHandle UHeights = ShaderUniform("Heights");
+static const ShaderHandle UTiles = ShaderUniform("Tiles");
+static const ShaderHandle UChunk = ShaderUniform("Chunk");
+
 void Terrain::CreateShader() {
 	TerrainShader = new Shader("./data/TerrainShaderVertex.vs", "./data/TerrainShaderFragment.frag");
+	if(GPUExpand) {
+		GPUShader = new Shader("./data/TerrainGPUShaderVertex.vs", "./data/TerrainShaderFragment.frag");
+		PickShader = new Shader("./data/TerrainGPUShaderVertex.vs", "./data/TerrainPickFragment.frag");
+	} else {
+		PickShader = new Shader("./data/TerrainShaderVertex.vs", "./data/TerrainPickFragment.frag");
+	}
+}
+
+static inline uint8_t Unorm8(float f) {
+	return (uint8_t)(glm::clamp(f, 0.0f, 1.0f)*255.0f+0.5f);
+}
+
+static inline uint8_t TileVertexFlags(uint32_t t) {
+	return TileTerrainType(t) == TER_CLIFFFACE ? TERRAIN_VERTEX_CLIFF : 0;
+}
+
+// Texture layer, coordinates and flags of 4 corners per tile for count
+// tiles. Branch free, every corner is one table lookup
+static void TerrainTexturesRow(TerrainVertex* out, const uint32_t* bits, int count) {
+	for(int i=0; i<count; i++) {
+		uint32_t t = bits[i];
+		const TileOrientation &o = TileOrientationOf(t);
+		uint8_t flags = TileVertexFlags(t);
+		TerrainVertex* v = out + i*4;
+		for(int c=0; c<4; c++) {
+			// texture corners 1 and 2 are on the right, 2 and 3 at the bottom
+			int k = o.corner[c];
+			v[c].layer = TileTexture(t);
+			v[c].u = ((k+1)>>1 & 1)*0xFF;
+			v[c].v = k >= 2 ? 0xFF : 0;
+			v[c].flags = flags;
+			v[c].pad = 0;
+		}
+	}
 }
 
 void Terrain::GetHeightmapFromMWT(WZmap* map) {
@@ -41,94 +100,398 @@ void Terrain::GetHeightmapFromMWT(WZmap* map) {
 	w = map->maptotalx;
 	h = map->maptotaly;
 	RenderingMode = GL_TRIANGLES;
-	GLvertexesCount = ((h-1)*(w-1)*2)*3*3*3;
-	GLvertexes = (float*)malloc(GLvertexesCount*sizeof(float));
-	size_t filled = 0;
-	auto addTriangle = [&] (float x1, float y1, float z1, float x2, float y2, float z2, float x3, float y3, float z3) {
-		// float* realloced = (float*)realloc(GLvertexes, (GLvertexesCount+9*3)*sizeof(float));
-		// if(realloced == NULL) {
-		// 	log_fatal("Realloc gived up at %ld", (GLvertexesCount+9*3)*sizeof(float));
-		// 	abort();
-		// }
-		if(filled > GLvertexesCount-9-9-9) {
-			log_fatal("Terrain vertex buffer overflow at %ld", filled);
-		}
-		GLvertexes[filled+0] = x1*128;
-		GLvertexes[filled+1] = y1*128;
-		GLvertexes[filled+2] = z1*128;
-		GLvertexes[filled+3] = 0;
-		GLvertexes[filled+4] = 0;
-		GLvertexes[filled+5] = 0;
-		GLvertexes[filled+6] = 0;
-		GLvertexes[filled+7] = 0;
-		GLvertexes[filled+8] = 0;
-		filled+=9;
-		GLvertexes[filled+0] = x2*128;
-		GLvertexes[filled+1] = y2*128;
-		GLvertexes[filled+2] = z2*128;
-		GLvertexes[filled+3] = 0;
-		GLvertexes[filled+4] = 0;
-		GLvertexes[filled+5] = 0;
-		GLvertexes[filled+6] = 0;
-		GLvertexes[filled+7] = 0;
-		GLvertexes[filled+8] = 0;
-		filled+=9;
-		GLvertexes[filled+0] = x3*128;
-		GLvertexes[filled+1] = y3*128;
-		GLvertexes[filled+2] = z3*128;
-		GLvertexes[filled+3] = 0;
-		GLvertexes[filled+4] = 0;
-		GLvertexes[filled+5] = 0;
-		GLvertexes[filled+6] = 0;
-		GLvertexes[filled+7] = 0;
-		GLvertexes[filled+8] = 0;
-		filled+=9;
-	};
-	float scale = 32.0f;
-	for(int y=0; y<h; y++) {
-		for(int x=0; x<w; x++) {
-			tiles[x][y].height = (float)map->mapheight[y*w+x]/scale;
-			tiles[x][y].triflip = WMT_TileGetTriFlip(map->maptile[y*w+x]);
-			tiles[x][y].texture = WMT_TileGetTexture(map->maptile[y*w+x]);
-			tiles[x][y].rot = WMT_TileGetRotation(map->maptile[y*w+x]);
-			tiles[x][y].fx = WMT_TileGetXFlip(map->maptile[y*w+x]);
-			tiles[x][y].fy = WMT_TileGetYFlip(map->maptile[y*w+x]);
-			tiles[x][y].tt = WMT_TileGetTerrainType(map->maptile[y*w+x], map->ttyptt);
+	heights.Resize(w, h);
+	tilebits.Resize(w, h);
+	WorkerPool().ParallelFor(h, [&](int y0, int y1) {
+		for(int y=y0; y<y1; y++) {
+			uint16_t* hrow = heights.Row(y);
+			uint32_t* trow = tilebits.Row(y);
+			for(int x=0; x<w; x++) {
+				unsigned short t = map->maptile[y*w+x];
+				hrow[x] = map->mapheight[y*w+x];
+				trow[x] = TilePack(WMT_TileGetTexture(t), WMT_TileGetRotation(t),
+					WMT_TileGetXFlip(t), WMT_TileGetYFlip(t), WMT_TileGetTriFlip(t),
+					WMT_TileGetTerrainType(t, map->ttyptt));
+			}
 		}
+	});
+	Pyramid.Build(heights);
+	log_info("Height pyramid: %d levels, %ld nodes", Pyramid.Levels(), Pyramid.NodeCount());
+	CreateChunks();
+	if(GPUExpand) {
+		ForEachChunkBand([&](TerrainChunk &c) {
+			UpdateChunkBounds(c);
+		});
+		log_info("Terrain expanded on GPU, no mesh built");
+		return;
 	}
-	for(int y=0; y<h-1; y++) {
-		for(int x=0; x<w-1; x++) {
-			// 0 1
-			// 3 2
-			if(WMT_TileGetTriFlip(map->maptile[y*w+x])) {
-				// 1 2
-				// 0
-				//
-				//   5
-				// 3 4
-				addTriangle(x,   tiles[x  ][y+1].height, y+1,
-							x,   tiles[x  ][y  ].height, y,
-							x+1, tiles[x+1][y  ].height, y);
-				addTriangle(x,   tiles[x  ][y+1].height, y+1,
-							x+1, tiles[x+1][y+1].height, y+1,
-							x+1, tiles[x+1][y  ].height, y);
+	// Every tile owns its 4 corners (texture coordinates differ between
+	// neighbouring tiles) and triangles reference them through GLindexes
+	size_t tilescount = (h-1)*(w-1);
+	if(Vertexes) {
+		free(Vertexes);
+	}
+	if(GLindexes) {
+		free(GLindexes);
+	}
+	VertexesCount = tilescount*4;
+	Vertexes = (TerrainVertex*)calloc(VertexesCount, sizeof(TerrainVertex));
+	GLindexesCount = tilescount*6;
+	GLindexes = (unsigned int*)malloc(GLindexesCount*sizeof(unsigned int));
+	if(Vertexes == NULL || GLindexes == NULL) {
+		log_fatal("Terrain buffers allocation fail");
+		abort();
+	}
+	Kernel = TerrainBestKernel();
+	log_info("Terrain mesh kernel: %s", Kernel->name);
+	auto start = std::chrono::steady_clock::now();
+	ForEachChunkBand([&](TerrainChunk &c) {
+		for(int y=c.y; y<c.y+c.h; y++) {
+			UpdateRowVertexes(Vertexes, GLindexes, y, c.x, c.x+c.w-1);
+		}
+		UpdateChunkBounds(c);
+	});
+	log_info("Terrain mesh: %ld vertexes (%ld KiB), %ld indexes (%ld KiB) in %.2f ms on %d threads",
+		VertexesCount, VertexesCount*sizeof(TerrainVertex)/1024,
+		GLindexesCount, GLindexesCount*sizeof(unsigned int)/1024,
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count(),
+		WorkerPool().Size());
+	log_info("WMT map exported.");
+	return;
+}
+
+void Terrain::CreateChunks() {
+	chunksw = (w-1 + TERRAIN_CHUNK_SIZE-1)/TERRAIN_CHUNK_SIZE;
+	chunksh = (h-1 + TERRAIN_CHUNK_SIZE-1)/TERRAIN_CHUNK_SIZE;
+	chunks.clear();
+	size_t firsttile = 0;
+	for(int cy=0; cy<chunksh; cy++) {
+		for(int cx=0; cx<chunksw; cx++) {
+			TerrainChunk c;
+			c.x = cx*TERRAIN_CHUNK_SIZE;
+			c.y = cy*TERRAIN_CHUNK_SIZE;
+			c.w = std::min(TERRAIN_CHUNK_SIZE, w-1-c.x);
+			c.h = std::min(TERRAIN_CHUNK_SIZE, h-1-c.y);
+			c.firsttile = firsttile;
+			firsttile += c.w*c.h;
+			chunks.push_back(c);
+		}
+	}
+	log_info("Terrain split into %dx%d chunks", chunksw, chunksh);
+}
+
+// Chunks are stored row after row, so a band of chunk rows owns one
+// continuous slice of Vertexes and GLindexes and bands never overlap.
+void Terrain::ForEachChunkBand(std::function<void(TerrainChunk&)> fn) {
+	WorkerPool().ParallelFor(chunksh, [&](int cy0, int cy1) {
+		for(int i=cy0*chunksw; i<cy1*chunksw; i++) {
+			fn(chunks[i]);
+		}
+	});
+}
+
+size_t Terrain::TileIndex(int x, int y) {
+	const TerrainChunk &c = chunks[(y/TERRAIN_CHUNK_SIZE)*chunksw + x/TERRAIN_CHUNK_SIZE];
+	return c.firsttile + (y-c.y)*c.w + (x-c.x);
+}
+
+void Terrain::UpdateChunkBounds(TerrainChunk &c) {
+	RegionBounds(c.x, c.y, c.x+c.w-1, c.y+c.h-1, &c.min, &c.max);
+}
+
+// World space box of tiles in inclusive rect
+void Terrain::RegionBounds(int x0, int y0, int x1, int y1, glm::vec3* min, glm::vec3* max) {
+	HeightPyramid::Bounds b = Pyramid.Query(x0, y0, x1, y1);
+	*min = glm::vec3(world_coord(x0), b.min*TERRAIN_HEIGHT_SCALE, world_coord(y0));
+	*max = glm::vec3(world_coord(x1+1), b.max*TERRAIN_HEIGHT_SCALE, world_coord(y1+1));
+}
+
+uint16_t Terrain::HighestPoint(int x0, int y0, int x1, int y1, int* px, int* py) {
+	return Pyramid.Highest(heights, x0, y0, x1, y1, px, py);
+}
+
+// Writes positions and triangle indexes of tiles [x0, x1] in row y into
+// mesh sized buffers, range has to be inside of one chunk to be
+// continuous in them
+void Terrain::UpdateRowVertexes(TerrainVertex* vertexes, unsigned int* indexes, int y, int x0, int x1) {
+	size_t first = TileIndex(x0, y);
+	Kernel->positions(vertexes + first*4, heights.Row(y)+x0, heights.Row(y+1)+x0, x0, y, x1-x0+1);
+	Kernel->indexes(indexes + first*6, tilebits.Row(y)+x0, first*4, x1-x0+1);
+}
+
+// Runs every supported row kernel over whole map, checks that they
+// match scalar one bit for bit and logs timings
+void Terrain::BenchmarkKernels() {
+	const TerrainRowKernel* kernels[] = {&TerrainKernelScalar, &TerrainKernelSSE2, &TerrainKernelAVX2};
+	const int iterations = 50;
+	size_t tilescount = (w-1)*(h-1);
+	std::vector<TerrainVertex> reference, vertexes(tilescount*4);
+	std::vector<unsigned int> referenceidx, indexes(tilescount*6);
+	for(auto k : kernels) {
+		if(!TerrainKernelSupported(k)) {
+			log_info("Kernel %s: not supported", k->name);
+			continue;
+		}
+		auto start = std::chrono::steady_clock::now();
+		for(int i=0; i<iterations; i++) {
+			for(int y=0; y<h-1; y++) {
+				size_t first = y*(w-1);
+				k->positions(vertexes.data() + first*4, heights.Row(y), heights.Row(y+1), 0, y, w-1);
+				k->indexes(indexes.data() + first*6, tilebits.Row(y), first*4, w-1);
+			}
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count()/iterations;
+		if(reference.empty()) {
+			reference = vertexes;
+			referenceidx = indexes;
+			log_info("Kernel %s: %.3f ms per map", k->name, ms);
+			continue;
+		}
+		bool same = indexes == referenceidx && SamePositions(vertexes.data(), reference.data(), tilescount*4);
+		log_info("Kernel %s: %.3f ms per map, output %s", k->name, ms, same ? "identical" : "DIFFERS");
+	}
+	// Banded build has to match serial one, both go into scratch buffers
+	// so live mesh keeps its texture layers
+	std::vector<TerrainVertex> banded(VertexesCount), serial(VertexesCount);
+	std::vector<unsigned int> bandedidx(GLindexesCount), serialidx(GLindexesCount);
+	auto build = [&](bool parallel) {
+		TerrainVertex* out = parallel ? banded.data() : serial.data();
+		unsigned int* outidx = parallel ? bandedidx.data() : serialidx.data();
+		auto start = std::chrono::steady_clock::now();
+		for(int i=0; i<iterations; i++) {
+			auto fn = [&](TerrainChunk &c) {
+				for(int y=c.y; y<c.y+c.h; y++) {
+					UpdateRowVertexes(out, outidx, y, c.x, c.x+c.w-1);
+				}
+			};
+			if(parallel) {
+				ForEachChunkBand(fn);
 			} else {
+				for(auto &c : chunks) {
+					fn(c);
+				}
+			}
+		}
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count()/iterations;
+	};
+	double bandedms = build(true);
+	double serialms = build(false);
+	bool same = SamePositions(banded.data(), serial.data(), VertexesCount) && bandedidx == serialidx;
+	log_info("Mesh build: serial %.3f ms, %d threads %.3f ms, output %s",
+		serialms, WorkerPool().Size(), bandedms, same ? "identical" : "DIFFERS");
+	// Texture pass over whole map, orientations are checked against step
+	// by step rotation and flips in tests/TerrainKernelsTest.cpp
+	std::vector<TerrainVertex> textured(VertexesCount);
+	auto start = std::chrono::steady_clock::now();
+	for(int i=0; i<iterations; i++) {
+		for(auto &c : chunks) {
+			for(int y=c.y; y<c.y+c.h; y++) {
+				TerrainTexturesRow(textured.data() + TileIndex(c.x, y)*4, tilebits.Row(y)+c.x, c.w);
+			}
+		}
+	}
+	double texturems = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count()/iterations;
+	log_info("Texture coordinates: %.3f ms per map", texturems);
+}
+
+// Height is set for map point (corner of up to 4 tiles)
+void Terrain::SetHeight(int x, int y, uint16_t height) {
+	if(x < 0 || y < 0 || x >= w || y >= h) {
+		return;
+	}
+	heights(x, y) = height;
+	Pyramid.Update(heights, x-1, y-1, x, y);
+	MarkDirty(x-1, y-1, x, y);
+}
+
+void Terrain::SetTile(int x, int y, int texture, int rot, bool fx, bool fy, bool triflip) {
+	if(x < 0 || y < 0 || x >= w-1 || y >= h-1) {
+		return;
+	}
+	uint32_t &t = tilebits(x, y);
+	t = TilePack(texture, rot, fx, fy, triflip, TileTerrainType(t));
+	MarkDirty(x, y, x, y);
+}
+
+// Rect is inclusive and in tiles, overlapping rects are merged
+void Terrain::MarkDirty(int x0, int y0, int x1, int y1) {
+	x0 = std::max(x0, 0);
+	y0 = std::max(y0, 0);
+	x1 = std::min(x1, w-2);
+	y1 = std::min(y1, h-2);
+	if(x0 > x1 || y0 > y1) {
+		return;
+	}
+	TerrainRect r = {x0, y0, x1, y1};
+	for(size_t i=0; i<DirtyRects.size(); i++) {
+		TerrainRect &d = DirtyRects[i];
+		if(r.x0 > d.x1+1 || r.x1 < d.x0-1 || r.y0 > d.y1+1 || r.y1 < d.y0-1) {
+			continue;
+		}
+		r.x0 = std::min(r.x0, d.x0);
+		r.y0 = std::min(r.y0, d.y0);
+		r.x1 = std::max(r.x1, d.x1);
+		r.y1 = std::max(r.y1, d.y1);
+		DirtyRects.erase(DirtyRects.begin()+i);
+		i = -1; // grown rect may now touch ones already checked
+	}
+	DirtyRects.push_back(r);
+}
+
+// Regenerates dirty tiles and uploads only their ranges, expects VAO bound
+void Terrain::UpdateDirty() {
+	if(DirtyRects.empty()) {
+		return;
+	}
+	UpdateDirtyGrounds();
+	if(GPUExpand) {
+		UpdateDirtyGPU();
+		return;
+	}
+	BindVBO();
+	for(auto &r : DirtyRects) {
+		for(int cy=r.y0/TERRAIN_CHUNK_SIZE; cy<=r.y1/TERRAIN_CHUNK_SIZE; cy++) {
+			for(int cx=r.x0/TERRAIN_CHUNK_SIZE; cx<=r.x1/TERRAIN_CHUNK_SIZE; cx++) {
+				TerrainChunk &c = chunks[cy*chunksw+cx];
+				int x0 = std::max(r.x0, c.x), x1 = std::min(r.x1, c.x+c.w-1);
+				int y0 = std::max(r.y0, c.y), y1 = std::min(r.y1, c.y+c.h-1);
+				// one row of tiles inside chunk is continuous in buffers
+				for(int y=y0; y<=y1; y++) {
+					UpdateRowVertexes(Vertexes, GLindexes, y, x0, x1);
+					UpdateRowTextures(y, x0, x1);
+					size_t first = TileIndex(x0, y), count = x1-x0+1;
+					glBufferSubData(GL_ARRAY_BUFFER, first*4*sizeof(TerrainVertex),
+						count*4*sizeof(TerrainVertex), Vertexes+first*4);
+					glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, first*6*sizeof(unsigned int),
+						count*6*sizeof(unsigned int), GLindexes+first*6);
+				}
+				UpdateChunkBounds(c);
+			}
+		}
+	}
+	DirtyRects.clear();
+	LODDirty = true;
+}
+
+// Largest level whose step evenly divides chunk sides
+static int ChunkMaxLOD(const Terrain::TerrainChunk &c) {
+	int l = 0;
+	while(l < TERRAIN_LOD_LEVELS-1 && c.w % (2<<l) == 0 && c.h % (2<<l) == 0) {
+		l++;
+	}
+	return l;
+}
+
+// Picks level for every chunk, returns true if LOD mesh has to be rebuilt
+bool Terrain::SelectLOD(glm::vec3 camera) {
+	for(auto &c : chunks) {
+		c.lod = 0;
+		if(!LODEnabled) {
+			continue;
+		}
+		float d = glm::length(camera - glm::clamp(camera, c.min, c.max));
+		int maxlod = ChunkMaxLOD(c);
+		for(float r = LODDistance; d >= r && c.lod < maxlod; r *= 2) {
+			c.lod++;
+		}
+	}
+	bool changed = LODDirty;
+	for(int cy=0; cy<chunksh; cy++) {
+		for(int cx=0; cx<chunksw; cx++) {
+			TerrainChunk &c = chunks[cy*chunksw+cx];
+			// level each side has to be stitched to, finer neighbours win
+			auto side = [&] (int nx, int ny) {
+				if(nx < 0 || ny < 0 || nx >= chunksw || ny >= chunksh) {
+					return c.lod;
+				}
+				return std::min(c.lod, chunks[ny*chunksw+nx].lod);
+			};
+			int sig = c.lod |
+				side(cx, cy-1) << 4 |
+				side(cx+1, cy) << 8 |
+				side(cx, cy+1) << 12 |
+				side(cx-1, cy) << 16;
+			if(sig != c.lodsig) {
+				c.lodsig = sig;
+				changed = true;
+			}
+		}
+	}
+	return changed;
+}
+
+// Coarse chunk mesh, one cell covers step*step tiles and takes texture
+// of its top left tile. Cells on chunk border next to finer chunk are
+// made as fan around cell center with border split to neighbour step,
+// so every neighbour vertex lies on our edge and there are no cracks.
+void Terrain::AppendChunkLOD(TerrainChunk &c) {
+	int s = 1<<c.lod;
+	int sides[4];
+	for(int i=0; i<4; i++) {
+		sides[i] = 1<<((c.lodsig>>((i+1)*4))&0xF);
+	}
+	for(int cy=c.y; cy<c.y+c.h; cy+=s) {
+		for(int cx=c.x; cx<c.x+c.w; cx+=s) {
+			float tc[4][2];
+			TileTextureCorners(cx, cy, tc);
+			uint8_t flags = TileVertexFlags(tilebits(cx, cy));
+			uint16_t layer = TileTexture(tilebits(cx, cy));
+			auto emit = [&] (int px, int py) {
+				float fu = (float)(px-cx)/s, fv = (float)(py-cy)/s;
+				float uv[2];
 				// 0 1
-				//   2
-				//
-				// 3
-				// 4 5
-				addTriangle(x,   tiles[x  ][y  ].height, y,
-							x+1, tiles[x+1][y  ].height, y,
-							x+1, tiles[x+1][y+1].height, y+1);
-				addTriangle(x,   tiles[x  ][y  ].height, y,
-							x,   tiles[x  ][y+1].height, y+1,
-							x+1, tiles[x+1][y+1].height, y+1);
+				// 3 2
+				for(int i=0; i<2; i++) {
+					uv[i] = tc[0][i]*(1-fu)*(1-fv) + tc[1][i]*fu*(1-fv) + tc[2][i]*fu*fv + tc[3][i]*(1-fu)*fv;
+				}
+				LODvertexes.push_back({(int16_t)px, (int16_t)py, heights(px, py), layer, Unorm8(uv[0]), Unorm8(uv[1]), flags, 0});
+				return (unsigned int)(LODvertexes.size()-1);
+			};
+			// top right bottom left
+			bool stitch[4] = {
+				cy == c.y && sides[0] < s,
+				cx+s == c.x+c.w && sides[1] < s,
+				cy+s == c.y+c.h && sides[2] < s,
+				cx == c.x && sides[3] < s};
+			if(!stitch[0] && !stitch[1] && !stitch[2] && !stitch[3]) {
+				unsigned int i0 = emit(cx, cy), i1 = emit(cx+s, cy), i2 = emit(cx+s, cy+s), i3 = emit(cx, cy+s);
+				unsigned int i[6] = {i0, i1, i2, i0, i3, i2};
+				LODindexes.insert(LODindexes.end(), i, i+6);
+				continue;
+			}
+			int corners[5][2] = {{cx, cy}, {cx+s, cy}, {cx+s, cy+s}, {cx, cy+s}, {cx, cy}};
+			unsigned int center = emit(cx+s/2, cy+s/2);
+			unsigned int first = emit(cx, cy), prev = first;
+			for(int k=0; k<4; k++) {
+				int step = stitch[k] ? sides[k] : s;
+				int dx = (corners[k+1][0]-corners[k][0])/s;
+				int dy = (corners[k+1][1]-corners[k][1])/s;
+				for(int t=step; t<=s; t+=step) {
+					unsigned int cur = (k == 3 && t == s) ? first : emit(corners[k][0]+dx*t, corners[k][1]+dy*t);
+					unsigned int i[3] = {center, prev, cur};
+					LODindexes.insert(LODindexes.end(), i, i+3);
+					prev = cur;
+				}
 			}
 		}
 	}
-	log_info("WMT map exported.");
-	return;
+}
+
+void Terrain::RebuildLOD() {
+	LODvertexes.clear();
+	LODindexes.clear();
+	for(auto &c : chunks) {
+		c.lodfirstindex = LODindexes.size();
+		if(c.lod > 0) {
+			AppendChunkLOD(c);
+		}
+		c.lodindexcount = LODindexes.size()-c.lodfirstindex;
+	}
+	glBindVertexArray(LODVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, LODVBO);
+	glBufferData(GL_ARRAY_BUFFER, LODvertexes.size()*sizeof(TerrainVertex), LODvertexes.data(), GL_DYNAMIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, LODindexes.size()*sizeof(unsigned int), LODindexes.data(), GL_DYNAMIC_DRAW);
+	LODDirty = false;
 }
 
 int GetTerrainTilesetNumber(WZtileset t) {
@@ -155,91 +518,515 @@ const char* TerrainTilesetToString(WZtileset t) {
 	return "unknown";
 }
 
+static bool TextureCompressionEnabled() {
+	if(!ArgCompressTextures) {
+		return false;
+	}
+	if(!GLAD_GL_EXT_texture_compression_s3tc) {
+		log_warn("S3TC is not supported by driver, textures stay uncompressed");
+		return false;
+	}
+	return true;
+}
+
+static unsigned int BlockFormatGL(BlockFormat f) {
+	return f == BLOCK_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+}
+
+// Builds mip chain of one RGBA8 layer and compresses every level into
+// out[level] at place of the layer, returns PSNR of the first level
+static double CompressLayerMips(BlockFormat f, const uint8_t* rgba, int w, int h, int layer, std::vector<std::vector<uint8_t>> &out) {
+	std::vector<uint8_t> cur(rgba, rgba+(size_t)w*h*4), next, check(cur.size());
+	double psnr = 0;
+	for(size_t l=0; l<out.size(); l++) {
+		int lw = ImageMipSize(w, l), lh = ImageMipSize(h, l);
+		uint8_t* blocks = out[l].data() + BlockImageSize(f, lw, lh)*layer;
+		CompressImage(f, cur.data(), lw, lh, blocks);
+		if(l == 0) {
+			DecompressImage(f, blocks, lw, lh, check.data());
+			psnr = ImagePSNR(f, cur.data(), check.data(), (size_t)lw*lh);
+		}
+		if(l+1 < out.size()) {
+			next.resize((size_t)ImageMipSize(w, l+1)*ImageMipSize(h, l+1)*4);
+			ImageDownsample(cur.data(), lw, lh, next.data());
+			cur.swap(next);
+		}
+	}
+	return psnr;
+}
+
+// Builds mip chains of all tile layers with scalar and SSE2 box filters
+// and with glGenerateMipmap on the same pixels, level 1 of all of them
+// is compared to see how far the driver filter is from ours
+void Terrain::BenchmarkMipmaps() {
+	if(TileArray == 0) {
+		return;
+	}
+	const int iterations = 5;
+	int layers = DatasetLoaded, levels = ImageMipLevels(TileW, TileH);
+	if(levels < 3) {
+		return;
+	}
+	size_t layersize = (size_t)TileW*TileH*4;
+	std::vector<uint8_t> base(layersize*layers);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, TileArray);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_UNSIGNED_BYTE, base.data());
+	std::vector<std::vector<uint8_t>> mips(levels);
+	for(int l=1; l<levels; l++) {
+		mips[l].resize((size_t)ImageMipSize(TileW, l)*ImageMipSize(TileH, l)*4*layers);
+	}
+	auto chain = [&](void (*downsample)(const uint8_t*, int, int, uint8_t*), int i) {
+		for(int l=1; l<levels; l++) {
+			size_t prev = (size_t)ImageMipSize(TileW, l-1)*ImageMipSize(TileH, l-1)*4;
+			size_t cur = (size_t)ImageMipSize(TileW, l)*ImageMipSize(TileH, l)*4;
+			downsample(l == 1 ? base.data()+layersize*i : mips[l-1].data()+prev*i,
+				ImageMipSize(TileW, l-1), ImageMipSize(TileH, l-1), mips[l].data()+cur*i);
+		}
+	};
+	auto timed = [&](bool parallel, void (*downsample)(const uint8_t*, int, int, uint8_t*)) {
+		auto start = std::chrono::steady_clock::now();
+		for(int it=0; it<iterations; it++) {
+			if(parallel) {
+				WorkerPool().ParallelFor(layers, [&](int begin, int end) {
+					for(int i=begin; i<end; i++) {
+						chain(downsample, i);
+					}
+				});
+			} else {
+				for(int i=0; i<layers; i++) {
+					chain(downsample, i);
+				}
+			}
+		}
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count()/iterations;
+	};
+	double scalarms = timed(false, ImageDownsampleScalar);
+	std::vector<uint8_t> scalar1 = mips[1];
+	double simdms = timed(false, ImageDownsample);
+	double parallelms = timed(true, ImageDownsample);
+	bool same = scalar1 == mips[1];
+	unsigned int tmp = 0;
+	glGenTextures(1, &tmp);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tmp);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, TileW, TileH, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, base.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glFinish();
+	auto start = std::chrono::steady_clock::now();
+	for(int it=0; it<iterations; it++) {
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glFinish();
+	}
+	double driverms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count()/iterations;
+	std::vector<uint8_t> driver1(mips[1].size());
+	glGetTexImage(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA, GL_UNSIGNED_BYTE, driver1.data());
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glDeleteTextures(1, &tmp);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	int maxdiff = 0;
+	for(size_t i=0; i<driver1.size(); i++) {
+		maxdiff = std::max(maxdiff, abs(driver1[i]-mips[1][i]));
+	}
+	log_info("Mipmaps of %d layers %dx%d: scalar %.2f ms, sse2 %.2f ms (output %s), %d threads %.2f ms, glGenerateMipmap %.2f ms, max difference to driver %d",
+		layers, TileW, TileH, scalarms, simdms, same ? "identical" : "DIFFERS", WorkerPool().Size(), parallelms, driverms, maxdiff);
+	// Lower tile qualities are derived this way, it has to give same
+	// bytes no matter of path taken
+	std::vector<uint8_t> derived(mips[2].size()), derivedscalar(mips[2].size());
+	start = std::chrono::steady_clock::now();
+	WorkerPool().ParallelFor(layers, [&](int begin, int end) {
+		for(int i=begin; i<end; i++) {
+			ImageDownsampleSRGB(base.data()+layersize*i, TileW, TileH, 2, derived.data()+derived.size()/layers*i);
+		}
+	});
+	double derivedms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+	start = std::chrono::steady_clock::now();
+	for(int i=0; i<layers; i++) {
+		ImageDownsampleSRGBScalar(base.data()+layersize*i, TileW, TileH, 2, derivedscalar.data()+derived.size()/layers*i);
+	}
+	double derivedscalarms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+	log_info("Quarter size tiles in linear light: scalar %.2f ms, sse2 on %d threads %.2f ms, output %s",
+		derivedscalarms, WorkerPool().Size(), derivedms, derived == derivedscalar ? "identical" : "DIFFERS");
+}
+
+// Decodes images into layers of a texture array, compresses it if
+// enabled and keeps result in texture cache. Layer i is paths[i], null
+// or broken ones stay black. Layers are sized to the biggest image.
+static uint64_t TextureArrayKey(const char* name, int qual, const std::vector<const char*> &paths) {
+	std::vector<const char*> keypaths;
+	for(auto p : paths) {
+		keypaths.push_back(p ? p : "");
+	}
+	return TextureCacheKey(name, qual, TextureCompressionEnabled(), keypaths);
+}
+
+static bool LoadCachedTextureArray(const char* name, uint64_t key, int layers, unsigned int* tex, int* outw, int* outh) {
+	CachedTextureArray cached;
+	bool ok = TextureCacheLoad(key, &cached) && cached.layers == layers;
+	if(ok) {
+		log_info("[%s] loaded from cache %016llx", name, (unsigned long long)key);
+		TextureArrayUpload(tex, cached.level, cached.levels, cached.w, cached.h, cached.layers, cached.format);
+		*outw = cached.w;
+		*outh = cached.h;
+	}
+	TextureCacheRelease(&cached);
+	return ok;
+}
+
+// Only headers are read here, layers are sized to the biggest image
+static bool TextureArraySize(const char* name, const std::vector<const char*> &paths, int* outw, int* outh) {
+	int mw = 0, mh = 0;
+	for(auto p : paths) {
+		int fw, fh, fc;
+		if(p && stbi_info(p, &fw, &fh, &fc)) {
+			mw = std::max(mw, fw);
+			mh = std::max(mh, fh);
+		}
+	}
+	if(mw == 0 || mh == 0) {
+		log_error("No readable images for [%s]", name);
+		return false;
+	}
+	*outw = mw;
+	*outh = mh;
+	return true;
+}
+
+// Decodes path as RGBA into dst of mw x mh, nearest scaling if needed
+static bool DecodeLayer(const char* path, int mw, int mh, unsigned char* dst) {
+	int fw, fh, fc;
+	unsigned char* pixels = stbi_load(path, &fw, &fh, &fc, 4);
+	if(pixels == NULL) {
+		log_error("Error opening [%s]: %s", path, stbi_failure_reason());
+		return false;
+	}
+	if(fw == mw && fh == mh) {
+		memcpy(dst, pixels, (size_t)mw*mh*4);
+	} else {
+		log_warn("[%s] is %dx%d, scaling to %dx%d", path, fw, fh, mw, mh);
+		for(int y=0; y<mh; y++) {
+			for(int x=0; x<mw; x++) {
+				memcpy(dst + ((size_t)y*mw+x)*4, pixels + ((size_t)(y*fh/mh)*fw+x*fw/mw)*4, 4);
+			}
+		}
+	}
+	stbi_image_free(pixels);
+	return true;
+}
+
+// With shrink above 0 images are halved that many times in linear light
+static bool BakeTextureArray(const char* name, int qual, int shrink, const std::vector<const char*> &paths, unsigned int* tex, int* outw, int* outh) {
+	int layers = paths.size();
+	if(layers == 0) {
+		log_error("No images for [%s]", name);
+		return false;
+	}
+	bool compress = TextureCompressionEnabled();
+	uint64_t cachekey = TextureArrayKey(name, qual, paths);
+	if(LoadCachedTextureArray(name, cachekey, layers, tex, outw, outh)) {
+		return true;
+	}
+	int sw, sh;
+	if(!TextureArraySize(name, paths, &sw, &sh)) {
+		return false;
+	}
+	int mw = ImageMipSize(sw, shrink), mh = ImageMipSize(sh, shrink);
+	size_t layersize = (size_t)mw*mh*4;
+	std::vector<unsigned char> staging(layersize*layers);
+	std::atomic<int> failed(0);
+	auto start = std::chrono::steady_clock::now();
+	// Every image lands in its own layer, workers never share memory
+	WorkerPool().ParallelFor(layers, [&](int begin, int end) {
+		std::vector<unsigned char> source(shrink ? (size_t)sw*sh*4 : 0);
+		for(int i=begin; i<end; i++) {
+			unsigned char* layer = staging.data() + layersize*i;
+			if(paths[i] == nullptr || !DecodeLayer(paths[i], sw, sh, shrink ? source.data() : layer)) {
+				failed++;
+			} else if(shrink) {
+				ImageDownsampleSRGB(source.data(), sw, sh, shrink, layer);
+			}
+		}
+	});
+	log_info("[%s] decoded %d images (%d failed) in %.2f ms on %d threads", name, layers, failed.load(),
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count(),
+		WorkerPool().Size());
+	if(compress) {
+		BlockFormat f = ImageHasAlpha(staging.data(), (size_t)mw*mh*layers) ? BLOCK_BC3 : BLOCK_BC1;
+		std::vector<std::vector<uint8_t>> levels(ImageMipLevels(mw, mh));
+		for(size_t l=0; l<levels.size(); l++) {
+			levels[l].resize(BlockImageSize(f, ImageMipSize(mw, l), ImageMipSize(mh, l))*layers);
+		}
+		std::vector<double> psnr(layers);
+		start = std::chrono::steady_clock::now();
+		WorkerPool().ParallelFor(layers, [&](int begin, int end) {
+			for(int i=begin; i<end; i++) {
+				psnr[i] = CompressLayerMips(f, staging.data() + layersize*i, mw, mh, i, levels);
+			}
+		});
+		double minpsnr = psnr[0], meanpsnr = 0;
+		for(double p : psnr) {
+			minpsnr = std::min(minpsnr, p);
+			meanpsnr += p/layers;
+		}
+		log_info("[%s] compressed to %s in %.2f ms: %ld KiB -> %ld KiB, PSNR min %.2f dB mean %.2f dB", name,
+			f == BLOCK_BC1 ? "BC1" : "BC3",
+			std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count(),
+			staging.size()/1024, levels[0].size()/1024, minpsnr, meanpsnr);
+		std::vector<const unsigned char*> pointers;
+		for(auto &l : levels) {
+			pointers.push_back(l.data());
+		}
+		TextureArrayUpload(tex, pointers.data(), pointers.size(), mw, mh, layers, BlockFormatGL(f));
+	} else {
+		// Mips of every layer are built from that layer only
+		std::vector<std::vector<uint8_t>> levels(ImageMipLevels(mw, mh));
+		for(size_t l=1; l<levels.size(); l++) {
+			levels[l].resize((size_t)ImageMipSize(mw, l)*ImageMipSize(mh, l)*4*layers);
+		}
+		start = std::chrono::steady_clock::now();
+		WorkerPool().ParallelFor(layers, [&](int begin, int end) {
+			std::vector<uint8_t*> dst(levels.size());
+			for(int i=begin; i<end; i++) {
+				for(size_t l=1; l<levels.size(); l++) {
+					dst[l] = levels[l].data() + (size_t)ImageMipSize(mw, l)*ImageMipSize(mh, l)*4*i;
+				}
+				ImageMipChain(staging.data() + layersize*i, mw, mh, dst.data());
+			}
+		});
+		log_info("[%s] built %ld mip levels in %.2f ms", name, levels.size(),
+			std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count());
+		std::vector<const unsigned char*> pointers = {staging.data()};
+		for(size_t l=1; l<levels.size(); l++) {
+			pointers.push_back(levels[l].data());
+		}
+		TextureArrayUpload(tex, pointers.data(), pointers.size(), mw, mh, layers, GL_RGBA8);
+	}
+	if(failed == 0) {
+		TextureCacheStore(cachekey, *tex);
+	}
+	*outw = mw;
+	*outh = mh;
+	return true;
+}
+
 // Accepts path to directory with textures and qual as quality of tiles
 // qual can be 16, 32, 64 or 128
-void Terrain::CreateTexturePage(char* basepath, int qual, SDL_Renderer* rend) {
+void Terrain::CreateTexturePage(const char* basepath, int qual) {
 	log_trace("Loading tiles");
+	TilesBasePath = basepath;
+	TileQuality = qual;
 	int tilesetnum = GetTerrainTilesetNumber(tileset);
-	char* folderpath = sprcatr(NULL, "%stexpages/tertilesc%dhw-%d/", basepath, tilesetnum, qual);
-	log_trace("Folder path to search tiles: [%s]", folderpath);
-	int TotalTextures = 0;
-	struct TempTextures {
-		int n;
-		SDL_Texture* t;
-		int w, h;
-	} textsa[512];
-	DIR *d;
-	struct dirent *dir;
-	d = opendir(folderpath);
+	// Only the best quality on disk is read, lower ones are derived
+	// from it by halving
+	static const int qualities[] = {128, 64, 32, 16};
+	char* folderpath = NULL;
+	DIR *d = NULL;
+	int sourcequal = 0;
+	for(int q : qualities) {
+		free(folderpath);
+		folderpath = sprcatr(NULL, "%stexpages/tertilesc%dhw-%d/", basepath, tilesetnum, q);
+		log_trace("Folder path to search tiles: [%s]", folderpath);
+		d = opendir(folderpath);
+		if(d) {
+			sourcequal = q;
+			break;
+		}
+	}
 	if(!d) {
-		log_error("Can not open directory for listing");
+		log_error("Can not open any tiles directory for listing");
+		free(folderpath);
 		return;
 	}
-	log_info("Loading tiles from [%s]", folderpath);
+	int shrink = 0;
+	while(sourcequal >> (shrink+1) >= qual) {
+		shrink++;
+	}
+	if(sourcequal < qual) {
+		log_warn("Tiles of quality %d not found, using %d", qual, sourcequal);
+	}
+	// paths[n] is tile-n.png
+	std::vector<char*> paths;
+	struct dirent *dir;
+	log_info("Loading tiles from [%s] for quality %d", folderpath, qual);
 	while ((dir = readdir(d)) != NULL) {
 		if(equalstr(dir->d_name, ".") || equalstr(dir->d_name, "..")) {
 			continue;
 		}
-		size_t strtileidlen = 512;
-		char* strtileid = (char*)malloc(strtileidlen);
-		if(sscanf(dir->d_name, "tile-%500[0-9].pn%1[g]%c", strtileid, strtileid+strtileidlen-2, strtileid+strtileidlen-2) != 2) {
+		int n;
+		char ext;
+		if(sscanf(dir->d_name, "tile-%d.pn%c", &n, &ext) != 2 || ext != 'g' || n < 0 || n > 0x1FF) {
 			log_warn("Found non-matching file [%s] in texpages directory.", dir->d_name);
 			continue;
 		}
-		char* filep = sprcatr(NULL, "%s%s", folderpath, dir->d_name);
-		SDL_Texture* t = IMG_LoadTexture(rend, filep);
-		if(t == NULL) {
-			log_error("Error opening [%s] tile!", filep);
-			log_error("Details: %s (%s)", IMG_GetError(), strerror(errno));
-			continue;
+		if((int)paths.size() <= n) {
+			paths.resize(n+1, nullptr);
 		}
-		free(filep);
-		if(TotalTextures == 511) {
-			log_fatal("Yo wtf, more than 512 tiles? Crazy...");
-			break;
+		if(paths[n] != nullptr) {
+			log_warn("Tile %d found twice, skipping [%s]", n, dir->d_name);
+			continue;
 		}
-		textsa[TotalTextures].n = atoi(strtileid);
-		textsa[TotalTextures].t = t;
-		TotalTextures++;
-		free(strtileid);
+		paths[n] = sprcatr(NULL, "%s%s", folderpath, dir->d_name);
 	}
 	closedir(d);
-	log_info("Loaded %d tiles.", TotalTextures);
-	int mw = 0, mh = 0;
-	for(int i=0; i<TotalTextures; i++) {
-		SDL_QueryTexture(textsa[i].t, NULL, NULL, &textsa[i].w, &textsa[i].h);
-		if(textsa[i].w > mw) {
-			mw = textsa[i].w;
-		}
-		if(textsa[i].h > mh) {
-			mh = textsa[i].h;
-		}
-	}
-	UsingTexture = new Texture;
-	UsingTexture->tex = SDL_CreateTexture(rend, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, TotalTextures*mw, mh);
-	UsingTexture->w = TotalTextures*mw;
-	UsingTexture->h = mh;
-	DatasetLoaded = TotalTextures;
-	SDL_Texture* savedt = SDL_GetRenderTarget(rend);
-	SDL_SetRenderDrawBlendMode(rend, SDL_BLENDMODE_BLEND);
-	SDL_SetRenderTarget(rend, UsingTexture->tex);
-	SDL_RenderClear(rend);
-	for(int i=0; i<TotalTextures; i++) {
-		int pn = -1;
-		for(int j=0; j<TotalTextures; j++) {
-			if(textsa[j].n == i) {
-				pn = j;
-				break;
+	std::vector<const char*> cpaths(paths.begin(), paths.end());
+	TileCacheKey = TextureArrayKey(folderpath, qual, cpaths);
+	if(BakeTextureArray(folderpath, qual, shrink, cpaths, &TileArray, &TileW, &TileH)) {
+		DatasetLoaded = paths.size();
+		glBindTexture(GL_TEXTURE_2D_ARRAY, TileArray);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		log_info("Tiles %dx%d, %d layers", TileW, TileH, DatasetLoaded);
+	}
+	for(auto p : paths) {
+		free(p);
+	}
+	free(folderpath);
+}
+
+// Reloads tiles from texpages of another quality, residency is built
+// again on top of new array
+void Terrain::SetTileQuality(int qual) {
+	if(qual == TileQuality) {
+		return;
+	}
+	Residency.Release();
+	CreateTexturePage(TilesBasePath.c_str(), qual);
+	if(ResidencyEnabled && !Residency.Build(TileArray, TileCacheKey, ResidencyBudgetMiB*1024*1024, ResidencyDemote)) {
+		ResidencyEnabled = false;
+	}
+}
+
+void Terrain::SetResidency(bool enabled) {
+	if(enabled == (Residency.HotArray != 0)) {
+		return;
+	}
+	ResidencyEnabled = enabled;
+	if(enabled) {
+		if(!Residency.Build(TileArray, TileCacheKey, ResidencyBudgetMiB*1024*1024, ResidencyDemote)) {
+			ResidencyEnabled = false;
+		}
+	} else {
+		// tile array was shrunk, full quality comes back from cache
+		Residency.Release();
+		CreateTexturePage(TilesBasePath.c_str(), TileQuality);
+	}
+}
+
+void Terrain::ConfigureResidency() {
+	if(Residency.HotArray != 0) {
+		Residency.Configure(TileArray, ResidencyBudgetMiB*1024*1024, ResidencyDemote);
+	}
+}
+
+// Tile layers used in visible chunks within ResidencyDistance, ranked by
+// distance from camera to nearest of such chunks
+void Terrain::UpdateResidency(glm::vec3 camera) {
+	if(Residency.HotArray == 0) {
+		return;
+	}
+	glm::vec3 local = glm::vec3(glm::inverse(GetMatrix()) * glm::vec4(camera, 1.0f));
+	std::vector<float> distance(DatasetLoaded, -1.0f);
+	for(int i : VisibleChunks) {
+		TerrainChunk &c = chunks[i];
+		float d = glm::distance(local, glm::clamp(local, c.min, c.max));
+		if(d > ResidencyDistance) {
+			continue;
+		}
+		for(int y=c.y; y<c.y+c.h; y++) {
+			for(int x=c.x; x<c.x+c.w; x++) {
+				int layer = TileTexture(tilebits(x, y));
+				if(layer < DatasetLoaded && (distance[layer] < 0 || d < distance[layer])) {
+					distance[layer] = d;
+				}
 			}
 		}
-		SDL_Rect from = {.x=0, .y=0, .w=textsa[pn].w, .h=textsa[pn].h};
-		SDL_Rect to = {.x=i*mw, .y=0, .w=textsa[pn].w, .h=textsa[pn].h};
-		SDL_RenderCopy(rend, textsa[pn].t, &from, &to);
-		SDL_DestroyTexture(textsa[pn].t);
 	}
-	SDL_SetRenderTarget(rend, savedt);
-	log_info("Tiles max resolution %dx%d", mw, mh);
-	free(folderpath);
+	Residency.Update(distance);
+}
+
+// Tile array on unit 0, full quality slots on 5 and slot table on 6
+void Terrain::BindTiles(Shader* shader) {
+	bool resident = Residency.HotArray != 0;
+	if(!resident && NoHotArray == 0) {
+		// one black layer and a table of no slots
+		const unsigned char black[4] = {0, 0, 0, 255};
+		const unsigned char* pixels = black;
+		TextureArrayUpload(&NoHotArray, &pixels, 1, 1, 1, 1, GL_RGBA8);
+		const int noslot = -1;
+		glGenTextures(1, &NoSlotsTex);
+		glBindTexture(GL_TEXTURE_2D, NoSlotsTex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, 1, 1, 0, GL_RED_INTEGER, GL_INT, &noslot);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, TileArray);
+	shader->Set(UTexture, 0);
+	shader->Set(UTileResidency, resident);
+	glActiveTexture(GL_TEXTURE5);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, resident ? Residency.HotArray : NoHotArray);
+	shader->Set(UTileHot, 5);
+	glActiveTexture(GL_TEXTURE6);
+	glBindTexture(GL_TEXTURE_2D, resident ? Residency.SlotsTex : NoSlotsTex);
+	shader->Set(UTileSlots, 6);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+float Terrain::RayTile(glm::vec3 origin, glm::vec3 dir, int x, int y) {
+	return TerrainRayTile(heights, tilebits, origin, dir, x, y);
+}
+
+bool Terrain::PickRay(glm::vec3 origin, glm::vec3 dir, glm::ivec2* tile, glm::vec3* hit) {
+	return TerrainPickRay(heights, tilebits, Pyramid, origin, dir, tile, hit);
+}
+
+// Rays from above at random spots against testing every tile
+void Terrain::BenchmarkPicking() {
+	const int rays = 2000;
+	std::vector<glm::vec3> origins, dirs;
+	srand(1);
+	for(int i=0; i<rays; i++) {
+		origins.push_back(glm::vec3(rand()%world_coord(w), 2048+rand()%4096, rand()%world_coord(h)));
+		dirs.push_back(glm::vec3((rand()%2001-1000)/1000.0f, -(rand()%1000+1)/1000.0f, (rand()%2001-1000)/1000.0f));
+	}
+	std::vector<glm::ivec2> walked(rays, glm::ivec2(-1, -1)), brute(rays, glm::ivec2(-1, -1));
+	auto start = std::chrono::steady_clock::now();
+	for(int i=0; i<rays; i++) {
+		PickRay(origins[i], dirs[i], &walked[i]);
+	}
+	double walkms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+	start = std::chrono::steady_clock::now();
+	for(int i=0; i<rays; i++) {
+		glm::vec3 d = glm::normalize(dirs[i]);
+		float best = -1.0f;
+		for(int y=0; y<h-1; y++) {
+			for(int x=0; x<w-1; x++) {
+				float t = RayTile(origins[i], d, x, y);
+				if(t >= 0.0f && (best < 0.0f || t < best)) {
+					best = t;
+					brute[i] = glm::ivec2(x, y);
+				}
+			}
+		}
+	}
+	double brutems = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+	int differ = 0;
+	for(int i=0; i<rays; i++) {
+		differ += walked[i].x != brute[i].x || walked[i].y != brute[i].y;
+	}
+	log_info("Picking %d rays: grid walk %.3f ms, all tiles %.3f ms, %d differ", rays, walkms, brutems, differ);
+}
+
+// Cursor in normalized device coordinates becomes a ray between near
+// and far planes of viewProjection
+bool Terrain::PickScreen(glm::mat4 viewProjection, glm::vec2 ndc, glm::ivec2* tile, glm::vec3* hit) {
+	glm::mat4 inv = glm::inverse(viewProjection * GetMatrix());
+	glm::vec4 n = inv * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+	glm::vec4 f = inv * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+	glm::vec3 near = glm::vec3(n)/n.w, far = glm::vec3(f)/f.w;
+	return PickRay(near, far-near, tile, hit);
 }
 
 void Terrain::LoadTerrainGrounds(char* basepath) {
@@ -260,12 +1047,16 @@ void Terrain::LoadTerrainGrounds(char* basepath) {
 	}
 	int count = -1;
 	char name[80] = {0};
-	int ret = fscanf(f, "%[^,]%d", name, &count);
+	int ret = fscanf(f, "%79[^,],%d", name, &count);
 	if(ret != 2) {
 		log_error("fscanf failed with %d fields readed instead of %d", ret, 2);
 	}
+	TileGrounds.clear();
+	if(count > 0) {
+		TileGrounds.resize(count);
+	}
 	for(int i=0; i<count; i++) {
-		ret = fscanf(f, "%25[^,]%25[^,]%25[^,]%25[^,]",
+		ret = fscanf(f, " %24[^,],%24[^,],%24[^,],%24[^\n]",
 						TileGrounds[i].names[0],
 						TileGrounds[i].names[1],
 						TileGrounds[i].names[2],
@@ -324,180 +1115,623 @@ void Terrain::LoadTerrainGroundTypes(char *basepath) {
 	LoadGroundTypesTextures(basepath);
 }
 
+// Ground pages become layers of GroundArray in gtypes order. Unless
+// they are cached, workers decode them into mapped pixel buffers and
+// StreamGrounds uploads them over next frames.
 void Terrain::LoadGroundTypesTextures(char* basepath) {
+	StopGroundStreaming();
+	std::vector<char*> paths;
 	for(int i=0; i<gtypescount; i++) {
-		log_debug("%02d Generating texture", i);
-		glGenTextures(1, &gtypes[i].tex);
-
-		log_debug("%02d Binding texture", i);
-		glBindTexture(GL_TEXTURE_2D, gtypes[i].tex);
-
-		char* path = sprcatr(NULL, "%stexpages/%s", basepath, gtypes[i].pagename);
-		int width, height, nrChannels;
-		log_debug("%02d Loading page [%s]", i, path);
-		unsigned char *data = stbi_load(path, &width, &height, &nrChannels, 0);
-		if(!data) {
-			log_fatal("%02d Failed to load page [%s]", i, path);
+		paths.push_back(sprcatr(NULL, "%stexpages/%s", basepath, gtypes[i].pagename));
+	}
+	char* name = sprcatr(NULL, "%stexpages/grounds-%d", basepath, GetTerrainTilesetNumber(tileset));
+	std::vector<const char*> cpaths(paths.begin(), paths.end());
+	GroundCacheKey = TextureArrayKey(name, 0, cpaths);
+	if(gtypescount > 0 && LoadCachedTextureArray(name, GroundCacheKey, gtypescount, &GroundArray, &GroundW, &GroundH)) {
+		for(int i=0; i<gtypescount; i++) {
+			GroundStreams[i].state = GROUND_RESIDENT;
+		}
+		SetGroundWrap();
+	} else if(gtypescount > 0 && TextureArraySize(name, cpaths, &GroundW, &GroundH)) {
+		StartGroundStreaming(cpaths);
+	}
+	for(auto p : paths) {
+		free(p);
+	}
+	free(name);
+}
+
+void Terrain::SetGroundWrap() {
+	glBindTexture(GL_TEXTURE_2D_ARRAY, GroundArray);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// Runs on a worker, mapped memory of g is written only until it flips
+// state and never once cancel is set
+static void DecodeGroundPage(Terrain::GroundStream &g, const std::string &path, int gw, int gh, int levels, bool compress, const std::atomic<bool> &cancel) {
+	std::vector<std::vector<uint8_t>> pixels(levels);
+	pixels[0].resize((size_t)gw*gh*4);
+	if(cancel || g.mapped == nullptr || !DecodeLayer(path.c_str(), gw, gh, pixels[0].data())) {
+		g.state = Terrain::GROUND_FAILED;
+		return;
+	}
+	uint64_t sum[3] = {0};
+	for(size_t p=0; p<pixels[0].size(); p+=4) {
+		for(int c=0; c<3; c++) {
+			sum[c] += pixels[0][p+c];
+		}
+	}
+	for(int c=0; c<3; c++) {
+		g.average[c] = sum[c]/((double)gw*gh*255.0);
+	}
+	if(compress) {
+		std::vector<std::vector<uint8_t>> blocks(levels);
+		for(int l=0; l<levels; l++) {
+			blocks[l].resize(BlockImageSize(BLOCK_BC1, ImageMipSize(gw, l), ImageMipSize(gh, l)));
+		}
+		CompressLayerMips(BLOCK_BC1, pixels[0].data(), gw, gh, 0, blocks);
+		pixels.swap(blocks);
+	} else {
+		std::vector<uint8_t*> dst(levels);
+		for(int l=1; l<levels; l++) {
+			pixels[l].resize((size_t)ImageMipSize(gw, l)*ImageMipSize(gh, l)*4);
+			dst[l] = pixels[l].data();
+		}
+		ImageMipChain(pixels[0].data(), gw, gh, dst.data());
+	}
+	if(cancel) {
+		g.state = Terrain::GROUND_FAILED;
+		return;
+	}
+	size_t offset = 0;
+	for(auto &l : pixels) {
+		memcpy(g.mapped + offset, l.data(), l.size());
+		offset += l.size();
+	}
+	g.state = Terrain::GROUND_DECODED;
+}
+
+// Cancels decode jobs, waits for ones already running and frees their
+// pixel buffers, ground pages that did not make it stay unfinished
+void Terrain::StopGroundStreaming() {
+	{
+		std::unique_lock<std::mutex> l(GroundJobsLock);
+		GroundJobsCancel = true;
+		GroundJobsDone.wait(l, [&]() { return GroundJobs == 0; });
+		GroundJobsCancel = false;
+	}
+	for(auto &g : GroundStreams) {
+		if(g.pbo == 0) {
 			continue;
 		}
-		log_debug("%02d Loading image to gl", i);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-		log_debug("%02d Generating mipmap", i);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		log_debug("%02d Freeing raw image", i);
-		stbi_image_free(data);
-		log_debug("%02d Loading done", i);
+		if(g.mapped != nullptr) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, g.pbo);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			g.mapped = nullptr;
+		}
+		glDeleteBuffers(1, &g.pbo);
+		g.pbo = 0;
+		g.state = GROUND_FAILED;
 	}
-	log_info("Ground textures loaded");
-	// TODO free this
+	GroundStreamsLeft = 0;
 }
 
-void Terrain::ConstructGroundAlphas() {
-	if(groundalphas) {
-		free(groundalphas);
+Terrain::~Terrain() {
+	StopGroundStreaming();
+}
+
+void Terrain::StartGroundStreaming(const std::vector<const char*> &paths) {
+	StopGroundStreaming();
+	bool compress = TextureCompressionEnabled();
+	// ground pages are opaque, alpha is never sampled
+	GroundFormat = compress ? BlockFormatGL(BLOCK_BC1) : GL_RGBA8;
+	GroundLevels = ImageMipLevels(GroundW, GroundH);
+	std::vector<const unsigned char*> empty(GroundLevels, nullptr);
+	TextureArrayUpload(&GroundArray, empty.data(), GroundLevels, GroundW, GroundH, gtypescount, GroundFormat);
+	SetGroundWrap();
+	size_t pagesize = 0;
+	for(int l=0; l<GroundLevels; l++) {
+		pagesize += TextureLevelSize(GroundFormat, GroundW, GroundH, 1, l);
 	}
-	groundalphas = NULL;
-	size_t layersize = w*h*sizeof(float);
-	groundalphas = (float*)malloc(layersize*gtypescount);
-	if(groundalphas == NULL) {
-		log_fatal("Allocation fail");
-		exit(1);
+	GroundStreamsLeft = gtypescount;
+	GroundStreamsFailed = 0;
+	GroundStreamStart = std::chrono::steady_clock::now();
+	GroundJobs = gtypescount;
+	for(int i=0; i<gtypescount; i++) {
+		GroundStream &g = GroundStreams[i];
+		glGenBuffers(1, &g.pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, g.pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, pagesize, NULL, GL_STREAM_DRAW);
+		g.mapped = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, pagesize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		g.level = 0;
+		g.state = GROUND_DECODING;
+		std::string path = paths[i];
+		int gw = GroundW, gh = GroundH, levels = GroundLevels;
+		WorkerPool().Submit([this, &g, path, gw, gh, levels, compress]() {
+			DecodeGroundPage(g, path, gw, gh, levels, compress, GroundJobsCancel);
+			std::lock_guard<std::mutex> l(GroundJobsLock);
+			GroundJobs--;
+			GroundJobsDone.notify_all();
+		});
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	log_info("Streaming %d ground pages %dx%d, %ld KiB each", gtypescount, GroundW, GroundH, pagesize/1024);
+}
+
+// Uploads decoded mip levels from pixel buffers until frame budget runs
+// out, at least one level goes each frame
+void Terrain::StreamGrounds() {
+	if(GroundStreamsLeft == 0) {
+		return;
 	}
+	auto start = std::chrono::steady_clock::now();
+	auto elapsed = [&]() {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+	};
+	bool uploaded = false;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, GroundArray);
 	for(int i=0; i<gtypescount; i++) {
+		GroundStream &g = GroundStreams[i];
+		if(g.pbo == 0) {
+			continue;
+		}
+		int state = g.state;
+		if(state == GROUND_DECODING) {
+			continue;
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, g.pbo);
+		if(g.mapped != nullptr) {
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			g.mapped = nullptr;
+		}
+		size_t offset = 0;
+		for(int l=0; l<g.level; l++) {
+			offset += TextureLevelSize(GroundFormat, GroundW, GroundH, 1, l);
+		}
+		while(state == GROUND_DECODED && g.level < GroundLevels && (!uploaded || elapsed() < GroundUploadBudget)) {
+			int lw = ImageMipSize(GroundW, g.level), lh = ImageMipSize(GroundH, g.level);
+			size_t size = TextureLevelSize(GroundFormat, GroundW, GroundH, 1, g.level);
+			if(GroundFormat == GL_RGBA8) {
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, g.level, 0, 0, i, lw, lh, 1, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)offset);
+			} else {
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, g.level, 0, 0, i, lw, lh, 1, GroundFormat, size, (const void*)offset);
+			}
+			offset += size;
+			g.level++;
+			uploaded = true;
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if(state == GROUND_FAILED || g.level == GroundLevels) {
+			glDeleteBuffers(1, &g.pbo);
+			g.pbo = 0;
+			if(state == GROUND_FAILED) {
+				GroundStreamsFailed++;
+			} else {
+				g.state = GROUND_RESIDENT;
+			}
+			GroundStreamsLeft--;
+		}
+		if(uploaded && elapsed() >= GroundUploadBudget) {
+			break;
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	if(GroundStreamsLeft == 0) {
+		log_info("Ground pages resident after %.2f ms, %d failed",
+			std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-GroundStreamStart).count(), GroundStreamsFailed);
+		if(GroundStreamsFailed == 0) {
+			TextureCacheStore(GroundCacheKey, GroundArray);
+		}
+	}
+}
+
+// 0 1
+// 3 2
+// Ground names of a tile texture go as x, y pairs: (0,0) (0,1) (1,0) (1,1)
+static const int GroundNameOfCorner[4] = {0, 2, 3, 1};
 
+int Terrain::TileCornerGround(uint32_t t, int corner) {
+	if(TileTexture(t) >= (int)TileGrounds.size()) {
+		return -1;
 	}
+	return TileGrounds[TileTexture(t)].gtype[GroundNameOfCorner[TileOrientationOf(t).corner[corner]]];
 }
 
-void Terrain::UpdateTexpageCoords() {
-	int filled = 0;
-	int tw = UsingTexture->w/DatasetLoaded;
-	log_info("%d %d %d", tw, UsingTexture->w, DatasetLoaded);
-	// // int th = UsingTexture->h;
-	auto SetNextTriangle = [&] (float c[2]) {
-		GLvertexes[filled+3] = c[0];
-		GLvertexes[filled+4] = c[1];
-		GLvertexes[filled+5] = 1.0f;
-		GLvertexes[filled+6] = 0.0f;
-		GLvertexes[filled+7] = 1.0f;
-		filled+=9;
-	};
-	auto SetNextTile = [&] (int j[6], float t[4][2]) {
-		for(int i=0; i<6; i++) {
-			SetNextTriangle(t[j[i]]);
+// Every map point gets a share of ground of each tile corner touching
+// it, weights of 4 present grounds are packed into one RGBA8 texel
+void Terrain::ConstructGroundAlphas() {
+	for(auto &g : TileGrounds) {
+		for(int c=0; c<4; c++) {
+			g.gtype[c] = -1;
+			for(int i=0; i<gtypescount; i++) {
+				if(equalstr(g.names[c], gtypes[i].groundtype)) {
+					g.gtype[c] = i;
+				}
+			}
 		}
-	};
+	}
+	bool used[GTYPESMAX] = {0};
 	for(int y=0; y<h-1; y++) {
 		for(int x=0; x<w-1; x++) {
-			// 0 1
-			// 3 2
-			float tex0[4][2] = {{(tiles[x][y].texture+0)/(float)DatasetLoaded, 0.0f},
-								{(tiles[x][y].texture+1)/(float)DatasetLoaded, 0.0f},
-								{(tiles[x][y].texture+1)/(float)DatasetLoaded, 1.0f},
-								{(tiles[x][y].texture+0)/(float)DatasetLoaded, 1.0f}};
-			int tord[6];
-			if(tiles[x][y].triflip) {
-				// 1 2
-				// 0
-				//
-				//   5
-				// 3 4
-				tord[0] = 3;
-				tord[1] = 0;
-				tord[2] = 1;
-				tord[3] = 3;
-				tord[4] = 2;
-				tord[5] = 1;
-			} else {
-				// 0 1
-				//   2
-				//
-				// 3
-				// 4 5
-				tord[0] = 0;
-				tord[1] = 1;
-				tord[2] = 2;
-				tord[3] = 0;
-				tord[4] = 3;
-				tord[5] = 2;
-			}
-			for(int numrot = 0; numrot<tiles[x][y].rot; numrot++) {
-				for(int i=0; i<6; i++) {
-					tord[i]--;
-					if(tord[i] == -1) {
-						tord[i] = 3;
-					}
+			for(int c=0; c<4; c++) {
+				int g = TileCornerGround(tilebits(x, y), c);
+				if(g >= 0) {
+					used[g] = true;
 				}
 			}
-			if(tiles[x][y].fx) {
-				for(int i=0; i<6; i++) {
-					if(tord[i] == 0) {
-						tord[i] = 1;
-					} else if(tord[i] == 1) {
-						tord[i] = 0;
-					} else if(tord[i] == 2) {
-						tord[i] = 3;
-					} else if(tord[i] == 3) {
-						tord[i] = 2;
-					}
+		}
+	}
+	GroundsPresent.clear();
+	for(int i=0; i<GTYPESMAX; i++) {
+		GroundSlot[i] = -1;
+		if(used[i]) {
+			GroundSlot[i] = GroundsPresent.size();
+			GroundsPresent.push_back(i);
+		}
+	}
+	GroundWeightLayers = std::max<int>(1, (GroundsPresent.size()+3)/4);
+	GroundWeights.assign((size_t)GroundWeightLayers*w*h*4, 0);
+	UpdateGroundWeights(0, 0, w-1, h-1);
+	log_info("Ground weights: %ld grounds present, %d layers, %ld KiB",
+		GroundsPresent.size(), GroundWeightLayers, GroundWeights.size()/1024);
+}
+
+// Recomputes weights of map points in rect, false if a ground without
+// a weight channel showed up and everything has to be rebuilt
+bool Terrain::UpdateGroundWeights(int x0, int y0, int x1, int y1) {
+	// tiles around point and their corner touching it
+	static const int around[4][3] = {{-1, -1, 2}, {0, -1, 3}, {-1, 0, 1}, {0, 0, 0}};
+	size_t layerstride = (size_t)w*h*4;
+	for(int py=y0; py<=y1; py++) {
+		for(int px=x0; px<=x1; px++) {
+			int count[(GTYPESMAX+3)/4*4] = {0}, total = 0;
+			for(auto &a : around) {
+				int tx = px+a[0], ty = py+a[1];
+				if(tx < 0 || ty < 0 || tx >= w-1 || ty >= h-1) {
+					continue;
+				}
+				int g = TileCornerGround(tilebits(tx, ty), a[2]);
+				if(g < 0) {
+					continue;
 				}
+				if(GroundSlot[g] < 0) {
+					return false;
+				}
+				count[GroundSlot[g]]++;
+				total++;
 			}
-			if(tiles[x][y].fy) {
-				for(int i=0; i<6; i++) {
-					if(tord[i] == 0) {
-						tord[i] = 3;
-					} else if(tord[i] == 3) {
-						tord[i] = 0;
-					} else if(tord[i] == 2) {
-						tord[i] = 1;
-					} else if(tord[i] == 1) {
-						tord[i] = 2;
-					}
+			uint8_t* texel = GroundWeights.data() + ((size_t)py*w+px)*4;
+			for(int l=0; l<GroundWeightLayers; l++) {
+				for(int c=0; c<4; c++) {
+					int n = count[l*4+c];
+					texel[l*layerstride+c] = total ? (n*255 + total/2)/total : 0;
 				}
 			}
-			SetNextTile(tord, tex0);
 		}
 	}
+	return true;
+}
+
+void Terrain::BufferGroundWeights() {
+	if(GroundWeightsTex == 0) {
+		glGenTextures(1, &GroundWeightsTex);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, GroundWeightsTex);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, w, h, GroundWeightLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, GroundWeights.data());
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// Only points around changed tiles are recomputed and uploaded
+void Terrain::UpdateDirtyGrounds() {
+	if(GroundWeightsTex == 0) {
+		return;
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, GroundWeightsTex);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+	glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, h);
+	for(auto &r : DirtyRects) {
+		if(!UpdateGroundWeights(r.x0, r.y0, r.x1+1, r.y1+1)) {
+			log_info("New ground type on map, rebuilding ground weights");
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+			ConstructGroundAlphas();
+			BufferGroundWeights();
+			return;
+		}
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, r.x0, r.y0, 0, r.x1-r.x0+2, r.y1-r.y0+2, GroundWeightLayers,
+			GL_RGBA, GL_UNSIGNED_BYTE, GroundWeights.data() + ((size_t)r.y0*w+r.x0)*4);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// Ground array and weights on texture units 3 and 4
+void Terrain::BindGrounds(Shader* shader) {
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, GroundArray);
+	shader->Set(UGrounds, 3);
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, GroundWeightsTex);
+	shader->Set(UGroundWeights, 4);
+	glActiveTexture(GL_TEXTURE0);
+	int layers[GTYPESMAX];
+	float scales[GTYPESMAX];
+	glm::vec4 placeholders[GTYPESMAX];
+	for(size_t i=0; i<GroundsPresent.size(); i++) {
+		GroundStream &g = GroundStreams[GroundsPresent[i]];
+		layers[i] = GroundsPresent[i];
+		scales[i] = 1.0f/(gtypes[GroundsPresent[i]].size*128.0f);
+		// average colour until all levels of page are uploaded, it is
+		// still being written while page decodes
+		int state = g.state;
+		for(int c=0; c<3; c++) {
+			placeholders[i][c] = state == GROUND_DECODING ? 0.5f : g.average[c];
+		}
+		placeholders[i][3] = state == GROUND_RESIDENT ? 0.0f : 1.0f;
+	}
+	int count = GroundsPresent.size();
+	shader->Set(UGroundCount, count);
+	shader->Set(UGroundLayers, layers, count);
+	shader->Set(UGroundScales, scales, count);
+	shader->Set(UGroundPlaceholders, placeholders, count);
+	shader->Set(UMapSize, glm::vec2(w, h));
+	shader->Set(UGroundMix, GroundMix);
+}
+
+void Terrain::UpdateTexpageCoords() {
+	if(GPUExpand) {
+		return; // computed by vertex shader
+	}
+	ForEachChunkBand([&](TerrainChunk &c) {
+		for(int y=c.y; y<c.y+c.h; y++) {
+			UpdateRowTextures(y, c.x, c.x+c.w-1);
+		}
+	});
+}
+
+// Texture coordinates inside tile layer of tile corners after rotation and flips
+void Terrain::TileTextureCorners(int x, int y, float c[4][2]) {
+	const TileOrientation &o = TileOrientationOf(tilebits(x, y));
+	for(int i=0; i<4; i++) {
+		int k = o.corner[i];
+		c[i][0] = (k+1)>>1 & 1;
+		c[i][1] = k >= 2 ? 1.0f : 0.0f;
+	}
+}
+
+// Writes texture coordinates of tiles [x0, x1] in row y, same range
+// rules as UpdateRowVertexes
+void Terrain::UpdateRowTextures(int y, int x0, int x1) {
+	TerrainTexturesRow(Vertexes + TileIndex(x0, y)*4, tilebits.Row(y)+x0, x1-x0+1);
 }
 
 // Makes up buffers and stores arrays
 void Terrain::BufferData() {
-	int shader = this->TerrainShader->program;
+	BufferGroundWeights();
+	if(GPUExpand) {
+		BufferGPU();
+		return;
+	}
 	glGenVertexArrays(1, &VAOv);
 	glGenBuffers(1, &VBOv);
+	glGenBuffers(1, &EBOv);
 	BindVAO();
 	BindVBO();
-	glBufferData(GL_ARRAY_BUFFER, GLvertexesCount*sizeof(float), GLvertexes, GL_STATIC_DRAW);
-	glVertexAttribPointer(glGetAttribLocation(shader, "VertexCoordinates"), 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(glGetAttribLocation(shader, "VertexCoordinates"));
-	glVertexAttribPointer(glGetAttribLocation(shader, "TextureCoordinates"), 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(glGetAttribLocation(shader, "TextureCoordinates"));
-	glVertexAttribPointer(glGetAttribLocation(shader, "TextureCliffCoordinates"), 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(glGetAttribLocation(shader, "TextureCliffCoordinates"));
+	BindEBO();
+	glBufferData(GL_ARRAY_BUFFER, VertexesCount*sizeof(TerrainVertex), Vertexes, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLindexesCount*sizeof(unsigned int), GLindexes, GL_STATIC_DRAW);
+	SetupVertexAttribs();
+	glGenVertexArrays(1, &LODVAO);
+	glGenBuffers(1, &LODVBO);
+	glGenBuffers(1, &LODEBO);
+	glBindVertexArray(LODVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, LODVBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, LODEBO);
+	SetupVertexAttribs();
+}
+
+// Vertex layout of currently bound VAO and VBO
+void Terrain::SetupVertexAttribs() {
+	Shader* shader = this->TerrainShader;
+	// attributes optimized out of shader are skipped
+	// integer attributes are passed as is, others converted to float
+	auto attrib = [shader] (const char* name, int size, GLenum type, bool normalized, bool integer, size_t offset) {
+		int loc = shader->Attribute(name);
+		if(loc < 0) {
+			return;
+		}
+		if(integer) {
+			glVertexAttribIPointer(loc, size, type, sizeof(TerrainVertex), (void*)offset);
+		} else {
+			glVertexAttribPointer(loc, size, type, normalized, sizeof(TerrainVertex), (void*)offset);
+		}
+		glEnableVertexAttribArray(loc);
+	};
+	attrib("VertexTile", 2, GL_SHORT, false, false, offsetof(TerrainVertex, x));
+	attrib("VertexHeight", 1, GL_UNSIGNED_SHORT, false, false, offsetof(TerrainVertex, height));
+	attrib("TextureLayer", 1, GL_UNSIGNED_SHORT, false, true, offsetof(TerrainVertex, layer));
+	attrib("TextureCoordinates", 2, GL_UNSIGNED_BYTE, true, false, offsetof(TerrainVertex, u));
+	attrib("VertexFlags", 1, GL_UNSIGNED_BYTE, false, true, offsetof(TerrainVertex, flags));
+}
+
+void Terrain::BindEBO() {
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBOv);
+}
+
+void Terrain::CullChunks(glm::mat4 viewProjection) {
+	Frustum f;
+	f.FromMatrix(viewProjection * GetMatrix());
+	DrawCounts.clear();
+	DrawOffsets.clear();
+	LODDrawCounts.clear();
+	LODDrawOffsets.clear();
+	VisibleChunks.clear();
+	ChunksVisible = 0;
+	TrianglesVisible = 0;
+	// neighbour chunks in a row are continuous in index buffer
+	auto add = [] (std::vector<GLsizei> &counts, std::vector<const void*> &offsets, size_t first, size_t count) {
+		const void* offset = (const void*)(first*sizeof(unsigned int));
+		if(!counts.empty() && (const char*)offsets.back() + counts.back()*sizeof(unsigned int) == offset) {
+			counts.back() += count;
+		} else {
+			counts.push_back(count);
+			offsets.push_back(offset);
+		}
+	};
+	for(auto &c : chunks) {
+		if(!f.IntersectsAABB(c.min, c.max)) {
+			continue;
+		}
+		if(c.lod == 0) {
+			add(DrawCounts, DrawOffsets, c.firsttile*6, c.w*c.h*6);
+			TrianglesVisible += c.w*c.h*2;
+		} else {
+			add(LODDrawCounts, LODDrawOffsets, c.lodfirstindex, c.lodindexcount);
+			TrianglesVisible += c.lodindexcount/3;
+		}
+		VisibleChunks.push_back(&c-chunks.data());
+		ChunksVisible++;
+	}
 }
 
-void Terrain::RenderV(glm::mat4 view) {
+void Terrain::RenderV(glm::mat4 view, glm::vec3 camera) {
+	StreamGrounds();
+	if(GPUExpand) {
+		UpdateDirty();
+		CullChunks(view);
+		UpdateResidency(camera);
+		RenderGPU();
+		return;
+	}
 	this->TerrainShader->use();
-	glUniformMatrix4fv(glGetUniformLocation(this->TerrainShader->program, "ViewProjection"), 1, GL_FALSE, glm::value_ptr(view));
+	BindVAO();
+	UpdateDirty();
+	if(SelectLOD(camera)) {
+		RebuildLOD();
+	}
+	CullChunks(view);
+	UpdateResidency(camera);
 	this->Render();
 }
 
 void Terrain::Render() {
-	int shader = this->TerrainShader->program;
-	if(UsingTexture != nullptr) {
-		UsingTexture->Bind(UsingTexture->id);
-		glUniform1i(glGetUniformLocation(shader, "Texture"), UsingTexture->id);
-	}
-	glUniformMatrix4fv(glGetUniformLocation(shader, "Model"), 1, GL_FALSE, glm::value_ptr(GetMatrix()));
-	BindVAO();
-	BindVBO();
+	Shader* shader = this->TerrainShader;
+	BindTiles(shader);
+	BindGrounds(shader);
+	shader->Set(UModel, GetMatrix());
 	if(FillTextures) {
 		glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
 	} else {
 		glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
 	}
-	glDrawArrays(RenderingMode, 0, GLvertexesCount);
+	DrawChunks();
 	glFlush();
-	if(UsingTexture != nullptr) {
-		UsingTexture->Unbind();
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void Terrain::BufferGPU() {
+	// attributeless draws still need a VAO bound
+	glGenVertexArrays(1, &GPUVAO);
+	glGenTextures(1, &HeightsTex);
+	glGenTextures(1, &TilesTex);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glBindTexture(GL_TEXTURE_2D, HeightsTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, w, h, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, heights.Row(0));
+	glBindTexture(GL_TEXTURE_2D, TilesTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, w, h, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, tilebits.Row(0));
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	log_info("Terrain textures: %ld KiB", (size_t)w*h*(sizeof(uint16_t)+sizeof(uint32_t))/1024);
+}
+
+// Edits only touch texels of changed points and tiles
+void Terrain::UpdateDirtyGPU() {
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+	for(auto &r : DirtyRects) {
+		glBindTexture(GL_TEXTURE_2D, HeightsTex);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x0, r.y0, r.x1-r.x0+2, r.y1-r.y0+2, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &heights(r.x0, r.y0));
+		glBindTexture(GL_TEXTURE_2D, TilesTex);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x0, r.y0, r.x1-r.x0+1, r.y1-r.y0+1, GL_RED_INTEGER, GL_UNSIGNED_INT, &tilebits(r.x0, r.y0));
+		for(int cy=r.y0/TERRAIN_CHUNK_SIZE; cy<=r.y1/TERRAIN_CHUNK_SIZE; cy++) {
+			for(int cx=r.x0/TERRAIN_CHUNK_SIZE; cx<=r.x1/TERRAIN_CHUNK_SIZE; cx++) {
+				UpdateChunkBounds(chunks[cy*chunksw+cx]);
+			}
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	DirtyRects.clear();
+}
+
+// One instanced draw per visible chunk, instance is a tile
+void Terrain::RenderGPU() {
+	GPUShader->use();
+	Shader* shader = GPUShader;
+	shader->Set(UModel, GetMatrix());
+	BindTiles(shader);
+	BindGrounds(shader);
+	if(FillTextures) {
+		glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
+	} else {
+		glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
+	}
+	DrawChunksGPU(shader);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void Terrain::DrawChunks() {
+	BindVAO();
+	glMultiDrawElements(RenderingMode, DrawCounts.data(), GL_UNSIGNED_INT, DrawOffsets.data(), DrawCounts.size());
+	if(!LODDrawCounts.empty()) {
+		glBindVertexArray(LODVAO);
+		glMultiDrawElements(RenderingMode, LODDrawCounts.data(), GL_UNSIGNED_INT, LODDrawOffsets.data(), LODDrawCounts.size());
+	}
+}
+
+void Terrain::DrawChunksGPU(Shader* shader) {
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, HeightsTex);
+	shader->Set(UHeights, 1);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, TilesTex);
+	shader->Set(UTiles, 2);
+	glBindVertexArray(GPUVAO);
+	for(int i : VisibleChunks) {
+		TerrainChunk &c = chunks[i];
+		shader->Set(UChunk, glm::ivec3(c.x, c.y, c.w));
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 6, c.w*c.h);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Draws tile ids of chunks culled for this frame into bound PickBuffer
+void Terrain::RenderPick() {
+	PickShader->use();
+	Shader* shader = PickShader;
+	shader->Set(UModel, GetMatrix());
+	shader->Set(UMapSize, glm::ivec2(w, h));
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	if(GPUExpand) {
+		DrawChunksGPU(shader);
+	} else {
+		DrawChunks();
 	}
+	glActiveTexture(GL_TEXTURE0);
 }
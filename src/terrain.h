@@ -21,7 +21,21 @@
 #ifndef TERRAIN_H_INCLUDED
 #define TERRAIN_H_INCLUDED
 
+#include <stdint.h>
+#include <vector>
+#include <functional>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
 #include "wmt.hpp"
+#include "Frustum.h"
+#include "TerrainGrid.h"
+#include "TerrainKernels.h"
+#include "TileResidency.h"
+#include "HeightPyramid.h"
 #include "Shader.h"
 #include "Texture.h"
 #include "Object3d.h"
@@ -30,47 +44,193 @@ extern char* texpagesPath;
 
 #define GTYPESMAX 15
 
-/* The shift on a world coordinate to get the tile coordinate */
-#define TILE_SHIFT 7
-static inline int32_t world_coord(int32_t mapCoord) { return (uint32_t)mapCoord << TILE_SHIFT; }
-static inline int32_t map_coord(int32_t worldCoord) { return worldCoord >> TILE_SHIFT; }
+/* Chunk side in tiles, chunks are culled and drawn as a whole */
+#define TERRAIN_CHUNK_SIZE 16
+
+/* Level of detail count, level n chunk uses 1<<n tiles wide cells */
+#define TERRAIN_LOD_LEVELS 5
+
+/* Terrain type of packed tile, see TilePack */
+static inline WMT_TerrainTypes TileTerrainType(uint32_t t) { return (WMT_TerrainTypes)((t >> 14) & 0xF); }
 
 class Terrain : public Object3d {
 public:
+	~Terrain();
 	Shader* TerrainShader = nullptr;
-	struct tileinfo {
-		bool triflip;
-		float height;
-		int texture;
-		int rot;
-		bool fx, fy;
-		WMT_TerrainTypes tt;
-	} tiles[256][256];
+	// Map point heights in WZ units and packed per tile bits (see TilePack)
+	TerrainGrid<uint16_t> heights;
+	TerrainGrid<uint32_t> tilebits;
+	float WorldHeight(int x, int y) { return heights(x, y)*TERRAIN_HEIGHT_SCALE; }
+	// Min/max heights of tile regions, kept in sync by SetHeight
+	HeightPyramid Pyramid;
+	void RegionBounds(int x0, int y0, int x1, int y1, glm::vec3* min, glm::vec3* max);
+	uint16_t HighestPoint(int x0, int y0, int x1, int y1, int* px, int* py);
 	int w, h;
 	WZtileset tileset;
 	int DatasetLoaded;
+	unsigned int TileArray = 0; // one layer per tile texture with mipmaps
+	int TileW = 0, TileH = 0;
+	uint64_t TileCacheKey = 0; // texture cache file of TileArray
+	std::string TilesBasePath;
+	int TileQuality = 128; // 16, 32, 64 or 128
+	// Distance based residency, see TileResidency
+	TileResidency Residency;
+	bool ResidencyEnabled = false;
+	float ResidencyBudgetMiB = 4.0f;
+	int ResidencyDemote = 2; // mip levels all tiles lose
+	float ResidencyDistance = 2048.0f;
+	// Bound on residency units while it is off so samplers of different
+	// types never share a unit
+	unsigned int NoHotArray = 0, NoSlotsTex = 0;
+	void SetTileQuality(int qual);
+	void SetResidency(bool enabled);
+	void ConfigureResidency();
+	void UpdateResidency(glm::vec3 camera);
+	void BindTiles(Shader* shader);
 	struct GroundType {
 		char groundtype[80];
 		char pagename[256];
-		double size; // wif is this for?
-		unsigned int tex;
+		double size; // ground page covers size tiles
 	} gtypes[GTYPESMAX];
 	int gtypescount = 0;
-	float* groundalphas = NULL;
 	struct TileGround {
 		char names[4][25] = {0}; // 25 prob. overkill but who cares at this point
-	} TileGrounds[120]; // abstract size, recheck required
-	Texture *GroundTexpage = nullptr;
+		int gtype[4] = {-1, -1, -1, -1};
+	};
+	std::vector<TileGround> TileGrounds; // one per tile texture
+	unsigned int GroundArray = 0; // one layer per ground type
+	int GroundW = 0, GroundH = 0, GroundLevels = 0;
+	unsigned int GroundFormat = 0;
+	// Ground pages are decoded by workers straight into mapped pixel
+	// buffers, render thread uploads them within GroundUploadBudget ms
+	// per frame and shaders use average colour of page until then
+	enum GroundStreamState {
+		GROUND_DECODING,
+		GROUND_DECODED,
+		GROUND_FAILED,
+		GROUND_RESIDENT
+	};
+	struct GroundStream {
+		std::atomic<int> state{GROUND_DECODING};
+		unsigned int pbo = 0;
+		uint8_t* mapped = nullptr;
+		int level = 0; // next mip level to upload
+		float average[3] = {0.5f, 0.5f, 0.5f};
+	} GroundStreams[GTYPESMAX];
+	int GroundStreamsLeft = 0, GroundStreamsFailed = 0;
+	// Decode jobs reference GroundStreams, they are cancelled and waited
+	// for before streams are reused or terrain goes away
+	int GroundJobs = 0;
+	std::mutex GroundJobsLock;
+	std::condition_variable GroundJobsDone;
+	std::atomic<bool> GroundJobsCancel{false};
+	void StopGroundStreaming();
+	std::chrono::steady_clock::time_point GroundStreamStart;
+	float GroundUploadBudget = 2.0f;
+	uint64_t GroundCacheKey = 0;
+	// Per map point ground weights, only grounds used on the map get a
+	// channel, four channels per layer of RGBA8 array texture
+	std::vector<int> GroundsPresent; // channel -> gtypes index
+	int GroundSlot[GTYPESMAX]; // gtypes index -> channel or -1
+	int GroundWeightLayers = 0;
+	std::vector<uint8_t> GroundWeights; // [layer][y][x][4]
+	unsigned int GroundWeightsTex = 0;
+	float GroundMix = 0.0f;
+	// Used instead of float GLvertexes of Object3d. Every tile has 4
+	// vertexes and 6 indexes, 72 bytes (6 vertexes of 9 floats were 216)
+	TerrainVertex* Vertexes = NULL;
+	size_t VertexesCount = 0;
+	unsigned int* GLindexes = NULL;
+	size_t GLindexesCount = 0;
+	unsigned int EBOv;
+	// Tiles are stored chunk by chunk so every chunk is one
+	// continuous range of both vertexes and indexes
+	struct TerrainChunk {
+		int x, y, w, h; // in tiles
+		size_t firsttile;
+		glm::vec3 min, max;
+		int lod = 0;
+		int lodsig = -1; // level and stitched neighbour levels
+		size_t lodfirstindex = 0, lodindexcount = 0;
+	};
+	std::vector<TerrainChunk> chunks;
+	int chunksw = 0, chunksh = 0;
+	std::vector<GLsizei> DrawCounts;
+	std::vector<const void*> DrawOffsets;
+	int ChunksVisible = 0;
+	size_t TrianglesVisible = 0;
+	size_t TileIndex(int x, int y);
+	void CreateChunks();
+	void UpdateChunkBounds(TerrainChunk &c);
+	// Runs fn for every chunk, bands of chunk rows go to worker threads
+	void ForEachChunkBand(std::function<void(TerrainChunk&)> fn);
+	void CullChunks(glm::mat4 viewProjection);
+	bool LODEnabled = false;
+	float LODDistance = 4096.0f; // level goes up every time distance doubles
+	bool LODDirty = true;
+	unsigned int LODVAO, LODVBO, LODEBO;
+	std::vector<TerrainVertex> LODvertexes;
+	std::vector<unsigned int> LODindexes;
+	std::vector<GLsizei> LODDrawCounts;
+	std::vector<const void*> LODDrawOffsets;
+	bool SelectLOD(glm::vec3 camera);
+	void AppendChunkLOD(TerrainChunk &c);
+	void RebuildLOD();
+	// GPU expanded mode: heights and packed tiles live in integer
+	// textures and the vertex shader builds every tile from gl_VertexID
+	// and gl_InstanceID, no vertex or index buffers are made
+	bool GPUExpand = false;
+	Shader* GPUShader = nullptr;
+	unsigned int GPUVAO = 0, HeightsTex = 0, TilesTex = 0;
+	std::vector<int> VisibleChunks;
+	void BufferGPU();
+	void UpdateDirtyGPU();
+	void RenderGPU();
+	void DrawChunks();
+	void DrawChunksGPU(Shader* shader);
+	// GPU picking: tile ids (see PickBuffer) of the same visible chunks
+	Shader* PickShader = nullptr;
+	void RenderPick();
+	struct TerrainRect {
+		int x0, y0, x1, y1;
+	};
+	std::vector<TerrainRect> DirtyRects;
+	void MarkDirty(int x0, int y0, int x1, int y1);
+	void UpdateDirty();
+	void SetHeight(int x, int y, uint16_t height);
+	void SetTile(int x, int y, int texture, int rot, bool fx, bool fy, bool triflip);
+	// Picking: ray is walked through tile grid and tested against
+	// triangles of every tile it crosses, triflip included
+	float RayTile(glm::vec3 origin, glm::vec3 dir, int x, int y);
+	bool PickRay(glm::vec3 origin, glm::vec3 dir, glm::ivec2* tile, glm::vec3* hit = nullptr);
+	bool PickScreen(glm::mat4 viewProjection, glm::vec2 ndc, glm::ivec2* tile, glm::vec3* hit = nullptr);
 	void CreateShader();
 	void LoadTerrainGrounds(char *basepath);
 	void LoadTerrainGroundTypes(char *basepath);
 	void LoadGroundTypesTextures(char *basepath);
+	void SetGroundWrap();
+	void StartGroundStreaming(const std::vector<const char*> &paths);
+	void StreamGrounds();
 	void ConstructGroundAlphas();
+	int TileCornerGround(uint32_t t, int corner);
+	bool UpdateGroundWeights(int x0, int y0, int x1, int y1);
+	void BufferGroundWeights();
+	void UpdateDirtyGrounds();
+	void BindGrounds(Shader* shader);
 	void UpdateTexpageCoords();
+	void TileTextureCorners(int x, int y, float c[4][2]);
+	void UpdateRowTextures(int y, int x0, int x1);
+	const TerrainRowKernel* Kernel = nullptr;
+	void UpdateRowVertexes(TerrainVertex* vertexes, unsigned int* indexes, int y, int x0, int x1);
+	void BenchmarkKernels();
+	void BenchmarkMipmaps();
+	void BenchmarkPicking();
 	void GetHeightmapFromMWT(WZmap* m);
-	void CreateTexturePage(char* basepath, int qual, SDL_Renderer* rend);
+	void CreateTexturePage(const char* basepath, int qual);
 	void BufferData();
-	void RenderV(glm::mat4 view);
+	void SetupVertexAttribs();
+	void BindEBO();
+	void RenderV(glm::mat4 view, glm::vec3 camera);
 	void Render();
 };
 
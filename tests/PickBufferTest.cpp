@@ -0,0 +1,227 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Renders terrain pick pass offscreen (EGL without any window, Mesa
+// llvmpipe is enough) and checks ids PickBuffer reads back. Exits with
+// 77, which CTest reports as skipped, when there is no EGL display.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <vector>
+
+#include "glad/glad.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "TerrainKernels.h"
+#include "PickBuffer.h"
+#include "PerFrame.h"
+#include "Shader.h"
+
+#define SKIP 77
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if(!(cond)) { \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while(0)
+
+static const ShaderHandle UModel = ShaderUniform("Model");
+static const ShaderHandle UMapSize = ShaderUniform("MapSize");
+
+// Map of MapW x MapH points drawn top down, every tile TilePixels wide,
+// map covers top left corner of the view and the rest stays empty
+static const int MapW = 8, MapH = 6;
+static const int TilePixels = 10;
+static const int ViewW = 100, ViewH = 80;
+
+static bool CreateContext() {
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getdisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(getdisplay == NULL) {
+		printf("No eglGetPlatformDisplayEXT\n");
+		return false;
+	}
+	EGLDisplay display = getdisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+		printf("No surfaceless EGL display\n");
+		return false;
+	}
+	const EGLint attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	if(!eglBindAPI(EGL_OPENGL_API)) {
+		printf("No desktop OpenGL in EGL\n");
+		return false;
+	}
+	EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attribs);
+	if(context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		printf("Can not create OpenGL 3.3 core context\n");
+		return false;
+	}
+	if(!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+		printf("Failed to load OpenGL functions\n");
+		return false;
+	}
+	printf("Renderer: %s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+	return true;
+}
+
+// Flat grid with two triangles per tile, laid out like terrain mesh
+static unsigned int CreateMesh(int* count) {
+	std::vector<TerrainVertex> vertexes;
+	for(int y=0; y<MapH; y++) {
+		for(int x=0; x<MapW; x++) {
+			TerrainVertex v = {};
+			v.x = x;
+			v.y = y;
+			vertexes.push_back(v);
+		}
+	}
+	std::vector<unsigned int> indexes;
+	for(int y=0; y<MapH-1; y++) {
+		for(int x=0; x<MapW-1; x++) {
+			unsigned int a = y*MapW+x, b = a+1, c = a+MapW, d = c+1;
+			unsigned int tile[6] = {a, b, d, a, d, c};
+			indexes.insert(indexes.end(), tile, tile+6);
+		}
+	}
+	unsigned int vao, vbo, ebo;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertexes.size()*sizeof(TerrainVertex), vertexes.data(), GL_STATIC_DRAW);
+	glGenBuffers(1, &ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexes.size()*sizeof(unsigned int), indexes.data(), GL_STATIC_DRAW);
+	// same locations and formats as Terrain::SetupVertexAttribs
+	glVertexAttribPointer(0, 2, GL_SHORT, false, sizeof(TerrainVertex), (void*)offsetof(TerrainVertex, x));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 1, GL_UNSIGNED_SHORT, false, sizeof(TerrainVertex), (void*)offsetof(TerrainVertex, height));
+	glEnableVertexAttribArray(1);
+	*count = indexes.size();
+	return vao;
+}
+
+// Orthographic top down view, world x goes right and z goes down the
+// screen, heights go to depth
+static glm::mat4 TopDown() {
+	float ww = world_coord(ViewW/TilePixels), wh = world_coord(ViewH/TilePixels);
+	glm::mat4 m(1.0f);
+	m[0][0] = 2.0f/ww;
+	m[3][0] = -1.0f;
+	m[1][1] = 0.0f;
+	m[1][2] = -1.0f/65536.0f;
+	m[2][1] = -2.0f/wh;
+	m[2][2] = 0.0f;
+	m[3][1] = 1.0f;
+	return m;
+}
+
+// Draws pick pass for window pixel x, y and waits for its readback
+static unsigned int Pick(PickBuffer &pick, Shader &shader, unsigned int vao, int count, int x, int y) {
+	if(!pick.Begin(ViewW, ViewH, x, y)) {
+		printf("FAIL %s:%d: readback ring is full\n", __FILE__, __LINE__);
+		failures++;
+		return PICK_NONE;
+	}
+	shader.use();
+	shader.Set(UModel, glm::mat4(1.0f));
+	shader.Set(UMapSize, glm::ivec2(MapW, MapH));
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, NULL);
+	pick.End();
+	glFinish();
+	unsigned int id = 0xFFFFFFFFu;
+	if(!pick.Poll(&id)) {
+		printf("FAIL %s:%d: no readback after glFinish\n", __FILE__, __LINE__);
+		failures++;
+	}
+	return id;
+}
+
+int main() {
+	if(!CreateContext()) {
+		printf("Skipped\n");
+		return SKIP;
+	}
+	Shader shader("data/TerrainShaderVertex.vs", "data/TerrainPickFragment.frag");
+	GLint linked = 0;
+	glGetProgramiv(shader.program, GL_LINK_STATUS, &linked);
+	if(!linked) {
+		printf("FAIL pick program does not link\n");
+		return 1;
+	}
+	PerFrame frame;
+	frame.Data.ViewProjection = TopDown();
+	frame.Data.Viewport = glm::vec4(0, 0, ViewW, ViewH);
+	frame.Update();
+	int count;
+	unsigned int vao = CreateMesh(&count);
+	PickBuffer pick;
+	// depth state of reversed main pass, Begin has to override it
+	glClearDepth(0.0);
+	glDepthFunc(GL_GREATER);
+	glDisable(GL_DEPTH_TEST);
+	// centre of every tile
+	for(int y=0; y<MapH-1; y++) {
+		for(int x=0; x<MapW-1; x++) {
+			unsigned int id = Pick(pick, shader, vao, count, x*TilePixels+TilePixels/2, y*TilePixels+TilePixels/2);
+			unsigned int want = y*MapW+x+1;
+			CHECK(id == want, "tile %d %d: got id %u, want %u", x, y, id, want);
+		}
+	}
+	GLint func;
+	glGetIntegerv(GL_DEPTH_FUNC, &func);
+	CHECK(func == GL_GREATER && !glIsEnabled(GL_DEPTH_TEST), "End did not restore depth state");
+	// right of map and below it
+	unsigned int id = Pick(pick, shader, vao, count, (MapW-1)*TilePixels+TilePixels/2, TilePixels/2);
+	CHECK(id == PICK_NONE, "right of map: got id %u", id);
+	id = Pick(pick, shader, vao, count, TilePixels/2, (MapH-1)*TilePixels+TilePixels/2);
+	CHECK(id == PICK_NONE, "below map: got id %u", id);
+	// two picks in flight, newer one (tile 1 0) wins
+	for(int i=0; i<2; i++) {
+		CHECK(pick.Begin(ViewW, ViewH, i*TilePixels+1, 1), "pick %d: readback ring is full", i);
+		shader.use();
+		glBindVertexArray(vao);
+		glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, NULL);
+		pick.End();
+	}
+	glFinish();
+	id = PICK_NONE;
+	CHECK(pick.Poll(&id) && id == 2, "two picks in flight: got id %u, want 2", id);
+	GLenum err = glGetError();
+	CHECK(err == GL_NO_ERROR, "GL error 0x%x", err);
+	if(failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
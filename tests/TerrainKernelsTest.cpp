@@ -0,0 +1,178 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "TerrainKernels.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if(!(cond)) { \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while(0)
+
+// Deterministic generator, tests have to be reproducible
+static uint32_t Next(uint32_t &seed) {
+	seed = seed*1664525u+1013904223u;
+	return seed >> 8;
+}
+
+// SIMD kernels against scalar one on generated rows, every start and
+// length so vector bodies and scalar tails are both covered
+static void TestKernelsMatchScalar() {
+	const int width = 67, rows = 4, firstrow = 250;
+	std::vector<uint16_t> heights((width+1)*(rows+1));
+	std::vector<uint32_t> bits(width*rows);
+	uint32_t seed = 1;
+	for(auto &h : heights) {
+		h = Next(seed) & 0xFFFF;
+	}
+	for(size_t i=0; i<bits.size(); i++) {
+		bits[i] = TilePack(Next(seed) % 512, i & 3, (i >> 2) & 1, (i >> 3) & 1, (i >> 4) & 1, Next(seed) % 12);
+	}
+	const TerrainRowKernel* kernels[] = {&TerrainKernelSSE2, &TerrainKernelAVX2};
+	for(auto k : kernels) {
+		if(!TerrainKernelSupported(k)) {
+			printf("Kernel %s: not supported, skipped\n", k->name);
+			continue;
+		}
+		int checked = 0;
+		for(int r=0; r<rows; r++) {
+			const uint16_t* h0 = heights.data() + r*(width+1);
+			const uint16_t* h1 = h0 + width+1;
+			const uint32_t* b = bits.data() + r*width;
+			for(int x=0; x<width; x++) {
+				for(int count=1; x+count<=width; count++) {
+					std::vector<TerrainVertex> want(count*4), got(count*4);
+					std::vector<unsigned int> wantidx(count*6), gotidx(count*6);
+					memset(want.data(), 0xAB, want.size()*sizeof(TerrainVertex));
+					memset(got.data(), 0xAB, got.size()*sizeof(TerrainVertex));
+					unsigned int base = 1000+x*4;
+					TerrainKernelScalar.positions(want.data(), h0+x, h1+x, x, firstrow+r, count);
+					TerrainKernelScalar.indexes(wantidx.data(), b+x, base, count);
+					k->positions(got.data(), h0+x, h1+x, x, firstrow+r, count);
+					k->indexes(gotidx.data(), b+x, base, count);
+					CHECK(SamePositions(want.data(), got.data(), count*4), "%s positions row %d x %d count %d", k->name, r, x, count);
+					CHECK(wantidx == gotidx, "%s indexes row %d x %d count %d", k->name, r, x, count);
+					checked++;
+				}
+			}
+		}
+		printf("Kernel %s: %d rows checked\n", k->name, checked);
+	}
+}
+
+// Rotation and flips applied one step at a time, the way tiles were
+// textured before orientation table, kept as reference for it
+static void TileTextureCornersLoop(uint32_t t, float c[4][2]) {
+	// 0 1
+	// 3 2
+	float tex0[4][2] = {{0.0f, 0.0f},
+						{1.0f, 0.0f},
+						{1.0f, 1.0f},
+						{0.0f, 1.0f}};
+	// tord[corner] is the texture corner mapped onto the tile corner
+	int tord[4] = {0, 1, 2, 3};
+	for(int numrot = 0; numrot<TileRotation(t); numrot++) {
+		for(int i=0; i<4; i++) {
+			tord[i]--;
+			if(tord[i] == -1) {
+				tord[i] = 3;
+			}
+		}
+	}
+	if(TileXFlip(t)) {
+		for(int i=0; i<4; i++) {
+			if(tord[i] == 0) {
+				tord[i] = 1;
+			} else if(tord[i] == 1) {
+				tord[i] = 0;
+			} else if(tord[i] == 2) {
+				tord[i] = 3;
+			} else if(tord[i] == 3) {
+				tord[i] = 2;
+			}
+		}
+	}
+	if(TileYFlip(t)) {
+		for(int i=0; i<4; i++) {
+			if(tord[i] == 0) {
+				tord[i] = 3;
+			} else if(tord[i] == 3) {
+				tord[i] = 0;
+			} else if(tord[i] == 2) {
+				tord[i] = 1;
+			} else if(tord[i] == 1) {
+				tord[i] = 2;
+			}
+		}
+	}
+	for(int i=0; i<4; i++) {
+		c[i][0] = tex0[tord[i]][0];
+		c[i][1] = tex0[tord[i]][1];
+	}
+}
+
+// Every orientation with first and last texture: table corners against
+// reference loop and kernel indexes against triflip of the tile
+static void TestOrientations() {
+	static const unsigned int straight[6] = {0, 1, 2, 0, 3, 2}, flipped[6] = {3, 0, 1, 3, 2, 1};
+	int differ = 0;
+	for(int o=0; o<32; o++) {
+		bool same = true;
+		for(int tex : {0, 511}) {
+			uint32_t t = TilePack(tex, o & 3, (o >> 2) & 1, (o >> 3) & 1, (o >> 4) & 1, 0);
+			float a[4][2], b[4][2];
+			TileTextureCornersLoop(t, a);
+			const TileOrientation &lut = TileOrientationOf(t);
+			for(int i=0; i<4; i++) {
+				int k = lut.corner[i];
+				b[i][0] = (k+1)>>1 & 1;
+				b[i][1] = k >= 2 ? 1.0f : 0.0f;
+			}
+			const unsigned int* idx = TileTriFlip(t) ? flipped : straight;
+			unsigned int kidx[6];
+			TerrainKernelScalar.indexes(kidx, &t, 0, 1);
+			CHECK(memcmp(a, b, sizeof(a)) == 0, "orientation %d texture %d corners", o, tex);
+			CHECK(memcmp(idx, kidx, sizeof(kidx)) == 0, "orientation %d texture %d indexes", o, tex);
+			same = same && memcmp(a, b, sizeof(a)) == 0 && memcmp(idx, kidx, sizeof(kidx)) == 0;
+		}
+		differ += !same;
+	}
+	printf("Orientations: %d of 32 differ\n", differ);
+}
+
+int main() {
+	TestKernelsMatchScalar();
+	TestOrientations();
+	if(failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
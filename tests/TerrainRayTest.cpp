@@ -0,0 +1,160 @@
+/*
+    This file is part of WZ2100 Map Editor.
+    Copyright (C) 2020-2021  maxsupermanhd
+    Copyright (C) 2020-2021  bjorn-ali-goransson
+
+    WZ2100 Map Editor is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    WZ2100 Map Editor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with WZ2100 Map Editor; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <vector>
+
+#include "TerrainKernels.h"
+#include "TerrainRay.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if(!(cond)) { \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while(0)
+
+// Deterministic generator, tests have to be reproducible
+static uint32_t Next(uint32_t &seed) {
+	seed = seed*1664525u+1013904223u;
+	return seed >> 8;
+}
+
+static float Random(uint32_t &seed, float lo, float hi) {
+	return lo+(hi-lo)*(Next(seed) & 0xFFFF)/65535.0f;
+}
+
+struct TestMap {
+	TerrainGrid<uint16_t> heights;
+	TerrainGrid<uint32_t> tiles;
+	HeightPyramid pyramid;
+};
+
+// Rolling hills with a few spikes, random triflips
+static void MakeMap(TestMap &m, int w, int h) {
+	uint32_t seed = 7;
+	m.heights.Resize(w, h);
+	m.tiles.Resize(w, h);
+	for(int y=0; y<h; y++) {
+		for(int x=0; x<w; x++) {
+			int v = 200+(x*37+y*11)%150+(x/16+y/16)%4*60;
+			if(Next(seed)%97 == 0) {
+				v += 400;
+			}
+			m.heights(x, y) = v;
+			m.tiles(x, y) = TilePack(0, 0, false, false, Next(seed) & 1, 0);
+		}
+	}
+	m.pyramid.Build(m.heights);
+}
+
+// Nearest hit over every tile, what walk has to agree with
+static bool BruteRay(TestMap &m, glm::vec3 origin, glm::vec3 dir, glm::ivec2* tile) {
+	dir = glm::normalize(dir);
+	float best = -1.0f;
+	for(int y=0; y<m.heights.h-1; y++) {
+		for(int x=0; x<m.heights.w-1; x++) {
+			float t = TerrainRayTile(m.heights, m.tiles, origin, dir, x, y);
+			if(t >= 0.0f && (best < 0.0f || t < best)) {
+				best = t;
+				*tile = glm::ivec2(x, y);
+			}
+		}
+	}
+	return best >= 0.0f;
+}
+
+static void CheckRay(TestMap &m, glm::vec3 origin, glm::vec3 dir, const char* what) {
+	glm::ivec2 walked(-1, -1), brute(-1, -1);
+	bool hw = TerrainPickRay(m.heights, m.tiles, m.pyramid, origin, dir, &walked, nullptr);
+	bool hb = BruteRay(m, origin, dir, &brute);
+	CHECK(hw == hb && (!hw || (walked.x == brute.x && walked.y == brute.y)),
+		"%s ray (%.2f %.2f %.2f) dir (%.4f %.4f %.4f): walk %d %d,%d brute %d %d,%d", what,
+		origin.x, origin.y, origin.z, dir.x, dir.y, dir.z, hw, walked.x, walked.y, hb, brute.x, brute.y);
+}
+
+// Steep rays from above anywhere on map
+static void TestRaysFromAbove(TestMap &m) {
+	uint32_t seed = 3;
+	float size = world_coord(m.heights.w-1);
+	for(int i=0; i<200; i++) {
+		glm::vec3 o(Random(seed, 0, size), Random(seed, 3000, 8000), Random(seed, 0, size));
+		glm::vec3 d(Random(seed, -1, 1), -Random(seed, 0.05f, 1), Random(seed, -1, 1));
+		CheckRay(m, o, d, "above");
+	}
+}
+
+// Long flat rays far from map origin skip many pyramid nodes where one
+// float ulp of position is bigger than any nudge, every one of them
+// has to end
+static void TestLargeCoordinateRays(TestMap &m) {
+	uint32_t seed = 5;
+	float size = world_coord(m.heights.w-1);
+	int count = 0;
+	for(int i=0; i<400; i++) {
+		glm::vec3 o(Random(seed, size*0.25f, size), Random(seed, 1500, 2600), Random(seed, size*0.25f, size));
+		glm::vec3 d(Random(seed, -1, 1), -Random(seed, 0.0f, 0.02f), Random(seed, -1, 1));
+		// axis aligned and diagonal ones too, they hit node corners
+		if(i%4 == 1) {
+			d.x = 0.0f;
+		} else if(i%4 == 2) {
+			d.z = d.x;
+		}
+		CheckRay(m, o, d, "far");
+		count++;
+	}
+	// starting outside of map, grazing along whole side
+	for(int i=0; i<100; i++) {
+		glm::vec3 o(size+Random(seed, 1, 5000), Random(seed, 600, 1200), Random(seed, 0, size));
+		glm::vec3 d(-1.0f, -Random(seed, 0.0f, 0.01f), Random(seed, -0.05f, 0.05f));
+		CheckRay(m, o, d, "outside");
+		count++;
+	}
+	printf("Large coordinate rays: %d walked\n", count);
+}
+
+static void Timeout(int) {
+	static const char msg[] = "FAIL: ray walk did not finish\n";
+	if(write(1, msg, sizeof(msg)-1)) {}
+	_exit(1);
+}
+
+int main() {
+	// a walk that never ends is a failure, not a hung test run
+	signal(SIGALRM, Timeout);
+	alarm(60);
+	TestMap m;
+	MakeMap(m, 256, 256);
+	TestRaysFromAbove(m);
+	TestLargeCoordinateRays(m);
+	if(failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}